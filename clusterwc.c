@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrcluster.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void Reduce(char* key, unsigned int partition_idx) {
+    int count = 0;
+    char *value, result[16];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count++;
+        free(value);
+    }
+    sprintf(result, "%d", count);
+    MR_Output(key, result);
+}
+
+// Usage: clusterwc [-w workers] [-p partitions] [-f | -n [-z]] file...
+// Counts words on worker processes (-f shuffles through files instead of
+// shared memory, -n through the workers' socket servers, -z compresses
+// the socket transfers)
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:fnz")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'f': MR_SetClusterShuffle(CLUSTER_SHUFFLE_FILES); break;
+        case 'n': MR_SetClusterShuffle(CLUSTER_SHUFFLE_SOCKET); break;
+        case 'z': MR_SetClusterFetch(true, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-f | -n [-z]] file...\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    MR_RunCluster(argc - optind, &argv[optind], Map, Reduce, workers, parts);
+    return MR_Cancelled() ? 1 : 0;
+}
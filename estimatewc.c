@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token) MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void Reduce(char* key, unsigned int partition_idx) {
+    int count = 0;
+    char *value, result[16];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count++;
+        free(value);
+    }
+    snprintf(result, sizeof(result), "%d", count);
+    MR_Output(key, result);
+}
+
+// Usage: estimatewc [-w workers] [-p partitions] [-f fraction] [-r] file...
+// Estimates the cost of a word count from a sample of its inputs (10% by
+// default) and prints it; with -r, then runs the job on the suggested
+// number of partitions
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    double fraction = 0.1;
+    bool run = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:f:r")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'f': fraction = atof(optarg); break;
+        case 'r': run = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-f fraction] [-r] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    JobEstimate estimate;
+    if (!MR_Estimate(argc - optind, &argv[optind], Map, Reduce, fraction, workers, parts, &estimate)) {
+        fprintf(stderr, "%s: nothing to sample\n", argv[0]);
+        return 1;
+    }
+    printf("sampled: %u inputs, %.1f%% of the bytes\n", estimate.inputs_sampled,
+           100 * estimate.sample_fraction);
+    printf("records: %.0f\n", estimate.records);
+    printf("shuffle: %.1f MiB\n", estimate.shuffle_bytes / (1024 * 1024));
+    printf("distinct keys: %.0f\n", estimate.distinct_keys);
+    printf("map: %.2fs, reduce: %.2fs\n", estimate.map_seconds, estimate.reduce_seconds);
+    printf("memory: %.1f MiB\n", estimate.memory_bytes / (1024 * 1024));
+    printf("partitions: %u\n", estimate.num_parts);
+
+    if (run) {
+        MR_Run(argc - optind, &argv[optind], Map, Reduce, workers, estimate.num_parts);
+    }
+    return MR_Cancelled() ? 1 : 0;
+}
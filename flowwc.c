@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrflow.h"
+
+// Split a line into (word, 1) records
+void Words(const char* file_name, const char* line, FlowOut* out) {
+    char *copy = strdup(line);
+    if (copy == NULL) return;
+    char *token, *dummy = copy;
+    while ((token = strsep(&dummy, " \t\r")) != NULL) {
+        Flow_emit(out, token, "1");
+    }
+    free(copy);
+}
+
+bool NotEmpty(const char* word, const char* count) {
+    return *word != '\0';
+}
+
+void Print(const char* word, const char* count, void* ctx) {
+    printf("%s: %s\n", word, count);
+}
+
+// Usage: flowwc [-w workers] [-p partitions] [-e] file...
+// Prints the count of every word in word order, computed by a dataflow
+// that fuses splitting and filtering into the map tasks of its one shuffle
+// (-e prints the stages instead)
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    bool explain = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:e")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'e': explain = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-e] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FlowPlan *plan = Flow_plan();
+    Flow *lines = Flow_text(plan, argc - optind, &argv[optind]);
+    Flow *words = Flow_filter(Flow_flat_map(lines, Words), NotEmpty);
+    Flow *counts = Flow_sort_by_key(Flow_reduce_by_key(words, Flow_sum));
+
+    if (explain) {
+        Flow_explain(counts, stdout);
+    } else {
+        Flow_run(counts, Print, NULL, workers, parts);
+    }
+    Flow_plan_free(plan);
+    return MR_Cancelled() ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+
+static void map_words(char* file_name, bool lower) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    // an attempt that lost its task to a speculative one stops early
+    while (!MR_Cancelled() && getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token == '\0') continue;
+            for (char *c = token; lower && *c; c++) *c = tolower((unsigned char)*c);
+            MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void Map(char* file_name) {
+    map_words(file_name, false);
+}
+
+void MapLower(char* file_name) {
+    map_words(file_name, true);
+}
+
+void Reduce(char* key, unsigned int partition_idx) {
+    long long count = 0;
+    char *value, result[32];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count += strtoll(value, NULL, 10);
+        free(value);
+    }
+    snprintf(result, sizeof(result), "%lld", count);
+    MR_Output(key, result);
+}
+
+// Usage: incrwc [-w workers] [-p partitions] [-c dir [-H]] [-k dir [-r]] [-s slowdown] [-l]
+//               file...
+// Word count that keeps the map output of each input in the cache
+// directory given with -c, so a rerun only maps the inputs that changed
+// (by size and mtime, or also by contents with -H); -l counts words
+// case-insensitively, a different job that caches its own output. -k
+// checkpoints the job in a directory, and -r resumes a run that crashed
+// or was interrupted from its checkpoints. -s runs a second attempt of
+// map tasks that fall that many times behind the others (e.g. inputs on a
+// slow disk), keeping whichever finishes first
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    char *cache = NULL, *checkpoint = NULL;
+    bool hash_contents = false, lower = false, resume = false;
+    double slowdown = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:c:Hk:rs:l")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'c': cache = optarg; break;
+        case 'H': hash_contents = true; break;
+        case 'k': checkpoint = optarg; break;
+        case 'r': resume = true; break;
+        case 's': slowdown = atof(optarg); break;
+        case 'l': lower = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-c dir [-H]] [-k dir [-r]] "
+                    "[-s slowdown] [-l] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    MR_SetCache(cache, hash_contents, "incrwc");
+    MR_SetCheckpoint(checkpoint, resume);
+    MR_SetSpeculation(slowdown);
+    MR_Run(argc - optind, &argv[optind], lower ? MapLower : Map, Reduce, workers, parts);
+    return MR_Cancelled() ? 1 : 0;
+}
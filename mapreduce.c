@@ -1,22 +1,41 @@
 #include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrcache.h"
+#include "mrcheckpoint.h"
+#include "mrcore.h"
+#include "mrhll.h"
+#include "mrinput.h"
+#include "mrtable.h"
+#include "runfile.h"
 #include "threadpool.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 // Key-value pair structure
 typedef struct KVPair {
     char *key;
     char *value;
     struct KVPair *next;
+    double number;      // key as a number, while sorting in numeric order
+    unsigned char tag;  // input of a join; orders the values of a key
+    bool mapped;        // key and value point into a mapped run (Core_add_mapped)
 } KVPair;
 
-// Partition structure
+// Partition structure: records are added in any order and sorted once,
+// when the partition is reduced
 typedef struct {
     KVPair *head;
+    KVTable *table;  // records combined by key (MR_SetPartitionCombine), or NULL
     pthread_mutex_t lock;
     size_t bytes;
 } Partition;
@@ -27,11 +46,76 @@ typedef struct {
     Reducer reducer_fn;
 } ReduceArgs;
 
-// File info for sorting map jobs by size
+// State of the map task of one input file
 typedef struct {
-    char *name;
-    size_t size;
-} FileInfo;
+    CacheEntry cache;       // cached output of the input (when caching is enabled)
+    CacheEntry checkpoint;  // checkpointed output (when checkpointing is enabled)
+} MapTask;
+
+// A map task submitted to the pool, which may run as more than one attempt
+typedef struct MapJob {
+    InputFile *file;
+    long long start_ns;   // when the first attempt started (0 while queued)
+    unsigned int attempts;  // attempts submitted
+    unsigned int pending;   // attempts submitted but not finished
+    unsigned int running;   // attempts running the mapper
+    bool done;              // an attempt has committed its output
+    ThreadPool_token_t lost;  // cancelled once an attempt wins, to stop the others
+    struct MapJob *next;    // next unfinished job
+} MapJob;
+
+// Map output of one attempt, held back until the attempt wins its task
+typedef struct {
+    KVPair **heads;  // per partition, most recent emit first
+    size_t *bytes;   // per partition
+} MapAttempt;
+
+// Map task of a map-only job and its result file
+typedef struct {
+    InputFile *file;
+    unsigned int task;
+    FILE *out;
+} MapOnlyTask;
+
+// Key orders; the built-in ones have sort paths of their own that compare
+// keys without calling through a pointer
+typedef enum {
+    ORDER_BYTES,     // strcmp
+    ORDER_NUMERIC,   // MR_CompareNumeric
+    ORDER_CASELESS,  // MR_CompareCaseless
+    ORDER_REVERSE,   // MR_CompareReverse
+    ORDER_CUSTOM     // a comparator set with MR_SetKeyOrder
+} KeyOrder;
+
+// A result kept by top-K mode
+typedef struct {
+    char *key;
+    char *value;
+} Ranked;
+
+// Bounded min-heap of the best results of a partition, worst at the root
+typedef struct {
+    Ranked *items;
+    unsigned int count;
+} TopHeap;
+
+// What the map task of one sampled input emitted during a dry run
+typedef struct {
+    size_t records;
+    size_t bytes;
+    HyperLogLog *keys;
+    HyperLogLog *early;    // keys of the first early_records records
+    size_t early_records;  // the last power of two reached
+} SampleStats;
+
+// A byte range of an input that a dry run maps, and the lines it holds
+typedef struct {
+    const char *name;
+    off_t offset;
+    unsigned int index;  // of its statistics
+    size_t bytes;        // of its lines, once mapped
+    InputFile block;
+} SampleRange;
 
 // Partition info for sorting reduce jobs by bytes
 typedef struct {
@@ -44,41 +128,358 @@ static Partition *partitions = NULL;
 static unsigned int num_partitions = 0;
 static ThreadPool_t *pool = NULL;
 static Mapper map_func = NULL;
+static OutputFn output_fn = NULL;
+static EmitFn emit_fn = NULL;
+static MapTask *map_tasks = NULL;  // indexed by InputFile index (MR_Run only)
+
+// Incremental runs: directory caching map output per input, or NULL
+static char *cache_dir = NULL;
+static bool cache_hash = false;
+static char *cache_job = NULL;
+
+// Checkpointing: directory of the job's checkpoints, or NULL
+static char *checkpoint_dir = NULL;
+static bool checkpoint_resume = false;
+// Partitions reduced before a restart (set while MR_Run checkpoints)
+static bool *partition_done = NULL;
+
+// Speculative execution: run a duplicate of map tasks taking longer than
+// spec_slowdown times their expected time (0 = never)
+static double spec_slowdown = 0;
+#define SPEC_MIN_NS 200000000LL  // never duplicate tasks younger than this
+
+// Order of the keys, and the comparator and hash of a custom order
+static KeyOrder key_order = ORDER_BYTES;
+static KeyComparator key_compare = NULL;
+static KeyHash key_hash = NULL;
 
-// Hash key to determine partition index
+// Secondary sort: order of the values of a key, or NULL to leave them in
+// arrival order
+static ValueComparator value_order = NULL;
+
+// Combining partitions: folds the records of a key as they arrive, or NULL
+// to keep every record, and the keys each table starts sized for
+static TableCombine partition_combine = NULL;
+static size_t partition_keys = 0;
+
+// Inputs tried in turn for a sample of the keys of a job
+#define SAMPLE_TRIES 4
+
+// Top-K mode: number of results kept (0 = all of them), their order, and
+// the heap of each partition while a job runs
+static unsigned int top_k = 0;
+static ValueComparator top_order = NULL;
+static TopHeap *top_heaps = NULL;
+
+// Dry runs: precision of the distinct-key estimators of the sampled inputs,
+// bytes malloc adds to each allocation, the partition size to aim for and
+// the length of the byte ranges sampled from plain inputs
+#define ESTIMATE_HLL_PRECISION 12
+#define ESTIMATE_MALLOC_OVERHEAD 16
+#define ESTIMATE_PART_BYTES (64.0 * 1024 * 1024)
+#define ESTIMATE_RANGE_BYTES (1 << 20)
+
+// Cancellation of the running (or next) job, whether the last job was
+// cancelled, and the time each map and reduce task may run (0 = no limit)
+static ThreadPool_token_t job_token;
+static bool last_cancelled = false;
+static unsigned int task_timeout_ms = 0;
+
+// How often waiting for the pool looks for stragglers and expired tasks
+#define POLL_MS 100
+
+// Unfinished map jobs and the throughput of finished ones
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static MapJob *map_jobs = NULL;
+static size_t done_bytes = 0;
+static long long done_ns = 0;
+static unsigned int done_count = 0;
+static unsigned int losing_attempts = 0;  // still running for a finished task
+
+// Output of the map attempt running on this thread while speculating,
+// and the task it belongs to
+static __thread MapAttempt *current_attempt = NULL;
+static __thread MapJob *current_job = NULL;
+
+// Where the map task running on this thread copies its emits (the
+// incremental cache and the checkpoint), if anywhere
+static __thread RunWriter *emit_capture[2] = { NULL, NULL };
+
+// Tag of the records this thread emits, and whether the job tags records
+// at all (set by a task before it emits, so seen by its own emits)
+static __thread unsigned char emit_tag = 0;
+static atomic_bool tagged_job = false;
+
+// Map-only jobs: where the records go, and the number of inputs (blocks of
+// pipe inputs are numbered as tasks after them)
+static bool map_only = false;
+static MapSink map_sink = NULL;
+static void *map_sink_ctx = NULL;
+static unsigned int map_only_inputs = 0;
+static unsigned int map_only_blocks = 0;
+
+// Dry runs: statistics of each map task of the sample (by InputFile index),
+// and those of the map task running on this thread
+static SampleStats *sample_stats = NULL;
+static __thread SampleStats *task_stats = NULL;
+
+// Key sampling (Core_sample_keys): bytes of an input mapped, and the
+// statistics of the sample this thread maps, whose records go nowhere else
+#define SAMPLE_BYTES (256 * 1024)
+static __thread SampleStats *key_sample = NULL;
+
+// Output of the map-only task running on this thread
+static __thread MapOnlyTask *map_only_task = NULL;
+
+// Partition being reduced by this thread and its result file
+static __thread unsigned int reduce_partition = 0;
+static __thread FILE *reduce_out = NULL;
+
+// Hash key to determine partition index; keys that the key order finds
+// equal hash alike
 unsigned int MR_Partitioner(char *key, unsigned int num_partitions) {
+    if (key_hash) return key_hash(key) % num_partitions;
     unsigned long hash = 5381;
     int c;
+    if (key_order == ORDER_CASELESS) {
+        while ((c = (unsigned char)*key++) != '\0') {
+            hash = ((hash << 5) + hash) + tolower(c);
+        }
+        return hash % num_partitions;
+    }
     while ((c = *key++) != '\0') {
         hash = ((hash << 5) + hash) + c; // hash * 33 + c
     }
     return hash % num_partitions;
 }
 
-// Insert key-value pair into partition in ascending order by key
-static void insert_sorted(Partition *partition, KVPair *pair) {
-    if (partition->head == NULL || strcmp(partition->head->key, pair->key) >= 0) {
-        pair->next = partition->head;
-        partition->head = pair;
-    } else {
-        KVPair *curr = partition->head;
-        
-        // Locate the node before the point of insertion
-        while (curr->next != NULL && strcmp(curr->next->key, pair->key) < 0) {
-            curr = curr->next;
+// Value of a key in numeric order; keys that are not numbers come last
+static double key_number(const char *key) {
+    char *end;
+    double number = strtod(key, &end);
+    return end == key || isnan(number) ? HUGE_VAL : number;
+}
+
+// Compare keys as numbers, and keys of equal value as strings
+int MR_CompareNumeric(const char *a, const char *b) {
+    double x = key_number(a), y = key_number(b);
+    if (x != y) return x < y ? -1 : 1;
+    return strcmp(a, b);
+}
+
+// Compare keys ignoring case
+int MR_CompareCaseless(const char *a, const char *b) {
+    return strcasecmp(a, b);
+}
+
+// Compare keys as strings, in descending order
+int MR_CompareReverse(const char *a, const char *b) {
+    return strcmp(b, a);
+}
+
+// Set the order of keys
+void MR_SetKeyOrder(KeyComparator compare, KeyHash hash) {
+    key_compare = compare;
+    key_hash = hash;
+    if (compare == NULL) key_order = ORDER_BYTES;
+    else if (compare == MR_CompareNumeric) key_order = ORDER_NUMERIC;
+    else if (compare == MR_CompareCaseless) key_order = ORDER_CASELESS;
+    else if (compare == MR_CompareReverse) key_order = ORDER_REVERSE;
+    else key_order = ORDER_CUSTOM;
+}
+
+// Compare keys in the job's key order
+int Core_compare_keys(const char *a, const char *b) {
+    return key_compare ? key_compare(a, b) : strcmp(a, b);
+}
+
+// Whether a record belongs to the group of key; only the caseless and
+// custom orders find keys with different bytes equal
+static bool same_key(const char *record_key, const char *key) {
+    switch (key_order) {
+    case ORDER_CASELESS: return strcasecmp(record_key, key) == 0;
+    case ORDER_CUSTOM: return key_compare(record_key, key) == 0;
+    default: return strcmp(record_key, key) == 0;
+    }
+}
+
+// Order of pairs: by key, then by tag, then by value if a value order is
+// set. Inlined into the sort of each key order, so that the switch folds
+// away and the built-in orders compare keys directly.
+static inline __attribute__((always_inline))
+int compare_pairs(KeyOrder order, const KVPair *a, const KVPair *b) {
+    int cmp;
+    switch (order) {
+    case ORDER_NUMERIC:
+        cmp = a->number != b->number ? (a->number < b->number ? -1 : 1) : strcmp(a->key, b->key);
+        break;
+    case ORDER_CASELESS: cmp = strcasecmp(a->key, b->key); break;
+    case ORDER_REVERSE: cmp = strcmp(b->key, a->key); break;
+    case ORDER_CUSTOM: cmp = key_compare(a->key, b->key); break;
+    default: cmp = strcmp(a->key, b->key); break;
+    }
+    if (cmp != 0) return cmp;
+    if (a->tag != b->tag) return (int)a->tag - (int)b->tag;
+    return value_order ? value_order(a->value, b->value) : 0;
+}
+
+// Merge two sorted lists, taking from a first on ties
+static inline __attribute__((always_inline))
+KVPair *merge_pairs(KeyOrder order, KVPair *a, KVPair *b) {
+    KVPair head, *tail = &head;
+    while (a && b) {
+        if (compare_pairs(order, b, a) < 0) {
+            tail->next = b;
+            b = b->next;
+        } else {
+            tail->next = a;
+            a = a->next;
         }
-        
-        pair->next = curr->next;
-        curr->next = pair;
+        tail = tail->next;
+    }
+    tail->next = a ? a : b;
+    return head.next;
+}
+
+// Stable bottom-up merge sort of a list: runs[i] holds a sorted run of
+// 2^i pairs taken before the ones that follow, so no memory is needed
+static inline __attribute__((always_inline))
+KVPair *sort_pairs(KeyOrder order, KVPair *list) {
+    KVPair *runs[64] = { NULL };
+    while (list) {
+        KVPair *run = list;
+        list = list->next;
+        run->next = NULL;
+        unsigned int i = 0;
+        for (; i < 63 && runs[i]; i++) {
+            run = merge_pairs(order, runs[i], run);
+            runs[i] = NULL;
+        }
+        runs[i] = runs[i] ? merge_pairs(order, runs[i], run) : run;
+    }
+    KVPair *sorted = NULL;
+    for (unsigned int i = 0; i < 64; i++) {
+        if (runs[i]) sorted = merge_pairs(order, runs[i], sorted);
+    }
+    return sorted;
+}
+
+// Sort the records of a partition in the key order, with a sort
+// specialized to each built-in order
+static void sort_partition(Partition *partition) {
+    KVPair *list = partition->head;
+    switch (key_order) {
+    case ORDER_NUMERIC:
+        for (KVPair *pair = list; pair; pair = pair->next) {
+            pair->number = key_number(pair->key);
+        }
+        list = sort_pairs(ORDER_NUMERIC, list);
+        break;
+    case ORDER_CASELESS: list = sort_pairs(ORDER_CASELESS, list); break;
+    case ORDER_REVERSE: list = sort_pairs(ORDER_REVERSE, list); break;
+    case ORDER_CUSTOM: list = sort_pairs(ORDER_CUSTOM, list); break;
+    default: list = sort_pairs(ORDER_BYTES, list); break;
+    }
+    partition->head = list;
+}
+
+// Write a record of a map-only task to its output
+static void map_only_emit(char *key, char *value) {
+    MapOnlyTask *task = map_only_task;
+    if (!task) return;
+    if (map_sink) {
+        map_sink(key, value, task->task, map_sink_ctx);
+        return;
+    }
+    if (!task->out) {
+        char name[32];
+        snprintf(name, sizeof(name), "result-%u.txt", task->task);
+        task->out = fopen(name, "w");
+        if (!task->out) return;
+    }
+    fprintf(task->out, "%s: %s\n", key, value);
+}
+
+// Free a record, and its strings unless they belong to a mapped run
+static void free_pair(KVPair *pair) {
+    if (!pair->mapped) {
+        free(pair->key);
+        free(pair->value);
+    }
+    free(pair);
+}
+
+// Fold a record into the table of a combining partition, whose lock the
+// caller holds
+static bool partition_fold(Partition *partition, const char *key, const char *value) {
+    if (!partition->table) {
+        // a table too large for memory may only be a wrong estimate
+        partition->table = Table_create(partition_keys);
+        if (!partition->table) partition->table = Table_create(0);
+        if (!partition->table) return false;
+    }
+    size_t keys = Table_count(partition->table);
+    if (!Table_add(partition->table, key, value, partition_combine)) return false;
+    if (Table_count(partition->table) > keys) partition->bytes += strlen(key) + strlen(value) + 2;
+    return true;
+}
+
+// Count a record in the statistics of a sample
+static void sample_record(SampleStats *stats, const char *key, const char *value) {
+    stats->records++;
+    stats->bytes += strlen(key) + strlen(value) + 2;
+    Hll_add(stats->keys, key);
+    if ((stats->records & (stats->records - 1)) == 0) {
+        // the snapshot only ever grows towards keys, so merging copies it
+        Hll_merge(stats->early, stats->keys);
+        stats->early_records = stats->records;
     }
 }
 
 // Emit a key-value pair to appropriate partition
 void MR_Emit(char *key, char *value) {
-    if (!key || !value || num_partitions == 0) return;
+    if (!key || !value) return;
+    if (key_sample) {
+        sample_record(key_sample, key, value);
+        return;
+    }
+    // a cancelled job takes no more records, nor does an attempt that lost
+    // its task
+    if (atomic_load_explicit(&job_token.cancelled, memory_order_relaxed)) return;
+    if (current_job && atomic_load_explicit(&current_job->lost.cancelled, memory_order_relaxed)) {
+        return;
+    }
+    if (map_only) {
+        map_only_emit(key, value);
+        return;
+    }
+    if (num_partitions == 0) return;
+    if (task_stats) sample_record(task_stats, key, value);
+    for (int i = 0; i < 2; i++) {
+        if (emit_capture[i]) Run_append(emit_capture[i], key, value);
+    }
+
     unsigned int idx = MR_Partitioner(key, num_partitions);
+    // partitions reduced before a restart take no more records
+    if (partition_done && partition_done[idx]) return;
+    if (emit_fn) {
+        emit_fn(key, value, idx);
+        return;
+    }
     Partition *partition = &partitions[idx];
 
+    // a combining partition keeps one record per key (unless the job tags
+    // records, as joins need each of them)
+    if (partition_combine && !current_attempt &&
+        !atomic_load_explicit(&tagged_job, memory_order_relaxed)) {
+        pthread_mutex_lock(&partition->lock);
+        bool ok = partition_fold(partition, key, value);
+        pthread_mutex_unlock(&partition->lock);
+        // out of memory: the results would be incomplete
+        if (!ok) MR_Cancel();
+        return;
+    }
+
     char *key_copy = strdup(key);
     char *val_copy = strdup(value);
 
@@ -86,29 +487,301 @@ void MR_Emit(char *key, char *value) {
     pair->key = key_copy;
     pair->value = val_copy;
     pair->next = NULL;
+    pair->tag = emit_tag;
+    pair->mapped = false;
+
+    // a map attempt keeps its output to itself until it wins its task
+    if (current_attempt) {
+        pair->next = current_attempt->heads[idx];
+        current_attempt->heads[idx] = pair;
+        current_attempt->bytes[idx] += strlen(key_copy) + strlen(val_copy) + 2;
+        return;
+    }
     
     // lock the partition to avoid race conditions among mapper threads
     pthread_mutex_lock(&partition->lock);
-    insert_sorted(partition, pair);
+    pair->next = partition->head;
+    partition->head = pair;
     partition->bytes += strlen(key_copy) + strlen(val_copy) + 2;
     pthread_mutex_unlock(&partition->lock);
 }
 
+// Submit a map or reduce task of the running job
+static bool add_task(ThreadPool_t *tp, thread_func_t func, void *arg, size_t size) {
+    return ThreadPool_add_cancellable_job(tp, func, arg, size, &job_token, task_timeout_ms);
+}
 
+// Monotonic clock in nanoseconds
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-// Map job wrapper function that runs in a pool worker
+// Move the output of a winning attempt into the partitions, or free the
+// output of a losing one
+static void attempt_finish(MapAttempt *attempt, bool commit) {
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        KVPair *pair = attempt->heads[i];
+        if (!pair) continue;
+        if (commit && partition_combine && !atomic_load(&tagged_job)) {
+            // fold the attempt's records into a combining partition, then
+            // free them
+            Partition *partition = &partitions[i];
+            bool ok = true;
+            pthread_mutex_lock(&partition->lock);
+            for (KVPair *p = pair; p && ok; p = p->next) {
+                ok = partition_fold(partition, p->key, p->value);
+            }
+            pthread_mutex_unlock(&partition->lock);
+            if (!ok) MR_Cancel();
+        } else if (commit) {
+            // splice the attempt's records onto the partition's
+            KVPair *tail = pair;
+            while (tail->next) tail = tail->next;
+            Partition *partition = &partitions[i];
+            pthread_mutex_lock(&partition->lock);
+            tail->next = partition->head;
+            partition->head = pair;
+            partition->bytes += attempt->bytes[i];
+            pthread_mutex_unlock(&partition->lock);
+            continue;
+        }
+        while (pair) {
+            KVPair *next = pair->next;
+            free_pair(pair);
+            pair = next;
+        }
+    }
+    free(attempt->heads);
+    free(attempt->bytes);
+}
+
+// Map job wrapper function that runs in a pool worker, once per attempt
 static void map_wrapper(void *arg) {
-    char *filename = (char *)arg;
-    map_func(filename);
+    MapJob *job = (MapJob *)arg;
+    InputFile *file = job->file;
+    MapTask *task = map_tasks && !file->block ? &map_tasks[file->index] : NULL;
+
+    // a duplicate that only starts once the task is done has nothing to do,
+    // and neither has a task of a cancelled job
+    pthread_mutex_lock(&jobs_lock);
+    bool skip = job->done || MR_Cancelled();
+    long long start = now_ns();
+    if (job->start_ns == 0) job->start_ns = start;
+    if (!skip) job->running++;
+    pthread_mutex_unlock(&jobs_lock);
+
+    bool won = false;
+    if (!skip) {
+        MapAttempt attempt = { NULL, NULL };
+        if (spec_slowdown > 0) {
+            attempt.heads = calloc(num_partitions, sizeof(KVPair *));
+            attempt.bytes = calloc(num_partitions, sizeof(size_t));
+            if (attempt.heads && attempt.bytes) current_attempt = &attempt;
+        }
+
+        // record the output of the task for the next run and for a restart
+        emit_capture[0] = task ? Cache_writer(&task->cache) : NULL;
+        emit_capture[1] = task ? Cache_writer(&task->checkpoint) : NULL;
+        task_stats = sample_stats && !file->block ? &sample_stats[file->index] : NULL;
+        current_job = job;
+        map_func(file->path);
+        current_job = NULL;
+        task_stats = NULL;
+        current_attempt = NULL;
+
+        // the first attempt to finish wins the task, unless it was cancelled
+        // and its output is incomplete
+        bool cancelled = MR_Cancelled();
+        pthread_mutex_lock(&jobs_lock);
+        bool first = !job->done;
+        job->done = true;
+        job->running--;
+        if (first) {
+            // the attempts still running have lost: stop them
+            losing_attempts += job->running;
+            if (job->running > 0) ThreadPool_cancel(&job->lost);
+        } else {
+            losing_attempts--;
+        }
+        won = first && !cancelled;
+        if (won) {
+            done_bytes += file->size;
+            done_ns += now_ns() - start;
+            done_count++;
+        }
+        pthread_mutex_unlock(&jobs_lock);
+
+        for (int i = 0; i < 2; i++) {
+            if (emit_capture[i]) {
+                if (won) Run_commit(emit_capture[i]);
+                else Run_abort(emit_capture[i]);
+            }
+            emit_capture[i] = NULL;
+        }
+        if (attempt.heads || attempt.bytes) attempt_finish(&attempt, won);
+    }
+
+    // the last attempt to finish releases the task
+    pthread_mutex_lock(&jobs_lock);
+    bool last = --job->pending == 0;
+    if (last) {
+        MapJob **link = &map_jobs;
+        while (*link && *link != job) link = &(*link)->next;
+        if (*link) *link = job->next;
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    if (last) {
+        Input_done(file);
+        free(job);
+    }
 }
 
-// Comparison function for sorting files by size
-int compare_file_size(const void *a, const void *b) {
-    FileInfo *fa = (FileInfo *)a;
-    FileInfo *fb = (FileInfo *)b;
-    if (fa->size > fb->size) return 1;
-    if (fa->size < fb->size) return -1;
-    return 0;
+// Whether the pool only runs map attempts that lost their task
+static bool only_losers_left(ThreadPool_t *tp) {
+    // losing attempts stop counting before they leave the pool, so busy
+    // workers equal to losing attempts means nothing else is running
+    pthread_mutex_lock(&jobs_lock);
+    pthread_mutex_lock(&tp->lock);
+    bool done = tp->jobs.size == 0 && tp->active_workers == losing_attempts;
+    pthread_mutex_unlock(&tp->lock);
+    pthread_mutex_unlock(&jobs_lock);
+    return done;
+}
+
+// Duplicate the running map tasks that are well behind the throughput of
+// the finished ones, as long as workers would otherwise be idle
+static void speculate(ThreadPool_t *tp) {
+    unsigned int idle = ThreadPool_idle_workers(tp);
+    if (idle == 0 || MR_Cancelled()) return;
+
+    pthread_mutex_lock(&jobs_lock);
+    long long now = now_ns();
+    for (MapJob *job = map_jobs; job && idle > 0 && done_count > 0; job = job->next) {
+        if (job->done || job->start_ns == 0 || job->attempts > 1) continue;
+
+        // expected time at the observed bytes per second (or the mean time
+        // per task when inputs are empty)
+        double expected = done_bytes > 0 ? (double)job->file->size * done_ns / done_bytes
+                                         : (double)done_ns / done_count;
+        long long elapsed = now - job->start_ns;
+        if (elapsed < SPEC_MIN_NS || elapsed < spec_slowdown * expected) continue;
+
+        if (add_task(tp, map_wrapper, job, job->file->size)) {
+            job->attempts++;
+            job->pending++;
+            idle--;
+        }
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+// Load the stored map output of an input into the partitions
+static void cache_load_job(void *arg) {
+    RunReader *reader = (RunReader *)arg;
+    char *key, *value;
+    while (!MR_Cancelled() && Run_next(reader, &key, &value)) {
+        MR_Emit(key, value);
+    }
+    Run_close(reader);
+}
+
+// Enable or disable incremental runs
+void MR_SetCache(const char *dir, bool hash_contents, const char *job) {
+    free(cache_dir);
+    free(cache_job);
+    cache_dir = dir ? strdup(dir) : NULL;
+    cache_job = dir && job ? strdup(job) : NULL;
+    cache_hash = hash_contents;
+    if (cache_dir) mkdir(cache_dir, 0777);
+}
+
+// Enable or disable checkpointing
+void MR_SetCheckpoint(const char *dir, bool resume) {
+    free(checkpoint_dir);
+    checkpoint_dir = dir ? strdup(dir) : NULL;
+    checkpoint_resume = resume;
+}
+
+// Wait until the pool has run all its jobs, not counting map attempts
+// that lost their task, while enforcing task timeouts and (in the map
+// phase) duplicating stragglers
+static void wait_for_jobs(ThreadPool_t *tp, bool map_phase) {
+    if (spec_slowdown == 0 && task_timeout_ms == 0) {
+        ThreadPool_check(tp);
+        return;
+    }
+    while (!ThreadPool_check_timed(tp, POLL_MS) && !only_losers_left(tp)) {
+        if (task_timeout_ms) ThreadPool_expire(tp);
+        if (map_phase && spec_slowdown > 0) speculate(tp);
+    }
+}
+
+// Submit a task of the running job
+bool Core_add_task(ThreadPool_t *tp, thread_func_t func, void *arg, size_t size) {
+    return add_task(tp, func, arg, size);
+}
+
+// Wait until the pool has run all its jobs, enforcing task timeouts
+void Core_wait(ThreadPool_t *tp) {
+    wait_for_jobs(tp, false);
+}
+
+// Get the time limit per task
+unsigned int Core_task_timeout(void) {
+    return task_timeout_ms;
+}
+
+// Enable or disable speculative execution of slow map tasks
+void MR_SetSpeculation(double slowdown) {
+    spec_slowdown = slowdown > 0 ? slowdown : 0;
+}
+
+// Set the order in which MR_GetNext returns the values of a key
+void MR_SetValueOrder(ValueComparator compare) {
+    value_order = compare;
+}
+
+// Combine the records of a key as they reach their partition
+void MR_SetPartitionCombine(TableCombine combine) {
+    partition_combine = combine;
+}
+
+// Keep only the best k results
+void MR_SetTopK(unsigned int k, ValueComparator compare) {
+    top_k = k;
+    top_order = compare;
+}
+
+// Set the time each map or reduce task may run
+void MR_SetTaskTimeout(unsigned int ms) {
+    task_timeout_ms = ms;
+}
+
+// Cancel the running job, or the next one if none is running
+void MR_Cancel(void) {
+    ThreadPool_cancel(&job_token);
+}
+
+// Whether the running (or last) job is cancelled, or the map attempt
+// running on this thread lost its task; a task past its deadline cancels
+// the whole job
+bool MR_Cancelled(void) {
+    if (ThreadPool_job_cancelled()) ThreadPool_cancel(&job_token);
+    if (current_job && atomic_load(&current_job->lost.cancelled)) return true;
+    return atomic_load(&job_token.cancelled) || last_cancelled;
+}
+
+// Set the block size used for pipe inputs
+void MR_SetBlockSize(size_t bytes) {
+    Input_set_block_size(bytes);
+}
+
+// Submit a map job once the input layer has the file ready
+// (the job queue orders map jobs by size)
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
 }
 
 // Comparison function for sorting partitions by bytes
@@ -129,18 +802,176 @@ char *MR_GetNext(char *key, unsigned int partition_idx) {
     Partition *partition = &partitions[partition_idx];
     KVPair *pair = partition->head;
 
-    if (!pair || strcmp(pair->key, key) != 0) {
+    if (!pair || !same_key(pair->key, key)) {
         return NULL;
     }
 
     partition->head = pair->next;
-    char *value = pair->value;
-    free(pair->key);
+    // the caller frees the value, so a mapped one is copied out
+    char *value = pair->mapped ? strdup(pair->value) : pair->value;
+    if (!pair->mapped) free(pair->key);
     free(pair);
+    if (!value) MR_Cancel();
 
     return value;
 }
 
+// Get the next value of a key with the given tag, dropping the values of
+// lower tags that come before it
+char *Core_next_tagged(char *key, unsigned int partition_idx, unsigned int tag) {
+    if (!key || partition_idx >= num_partitions) return NULL;
+    Partition *partition = &partitions[partition_idx];
+    KVPair *pair;
+    while ((pair = partition->head) != NULL && same_key(pair->key, key) && pair->tag < tag) {
+        partition->head = pair->next;
+        free_pair(pair);
+    }
+    if (!pair || !same_key(pair->key, key) || pair->tag != tag) return NULL;
+    return MR_GetNext(key, partition_idx);
+}
+
+// Rank of two results: by value, the greater first (numerically unless an
+// order is set), and by key on ties, the smaller first
+static int compare_ranked(const Ranked *a, const Ranked *b) {
+    int cmp;
+    if (top_order) {
+        cmp = top_order(a->value, b->value);
+    } else {
+        double x = strtod(a->value, NULL), y = strtod(b->value, NULL);
+        cmp = x < y ? -1 : x > y;
+    }
+    return cmp != 0 ? cmp : strcmp(b->key, a->key);
+}
+
+// Keep a result in a partition's heap if it is among the best top_k
+static void top_push(TopHeap *heap, char *key, char *value) {
+    Ranked item = { key, value };
+    if (heap->count == top_k && compare_ranked(&item, &heap->items[0]) <= 0) return;
+    if (!heap->items && !(heap->items = malloc(top_k * sizeof(Ranked)))) return;
+    if (!(item.key = strdup(key)) || !(item.value = strdup(value))) {
+        free(item.key);
+        return;
+    }
+
+    unsigned int i;
+    if (heap->count < top_k) {
+        // sift up from the end
+        i = heap->count++;
+        while (i > 0 && compare_ranked(&item, &heap->items[(i - 1) / 2]) < 0) {
+            heap->items[i] = heap->items[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+    } else {
+        // replace the worst, at the root, and sift down
+        free(heap->items[0].key);
+        free(heap->items[0].value);
+        i = 0;
+        for (;;) {
+            unsigned int child = 2 * i + 1;
+            if (child >= heap->count) break;
+            if (child + 1 < heap->count &&
+                compare_ranked(&heap->items[child + 1], &heap->items[child]) < 0) {
+                child++;
+            }
+            if (compare_ranked(&heap->items[child], &item) >= 0) break;
+            heap->items[i] = heap->items[child];
+            i = child;
+        }
+    }
+    heap->items[i] = item;
+}
+
+static int compare_ranked_desc(const void *a, const void *b) {
+    return compare_ranked((const Ranked *)b, (const Ranked *)a);
+}
+
+// Merge the partitions' heaps into result-top.txt, best first, and free them
+static void top_finish(void) {
+    size_t total = 0;
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        total += top_heaps[i].count;
+    }
+    Ranked *all = total ? malloc(total * sizeof(Ranked)) : NULL;
+    size_t n = 0;
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        if (all && top_heaps[i].count) {
+            memcpy(all + n, top_heaps[i].items, top_heaps[i].count * sizeof(Ranked));
+        }
+        n += top_heaps[i].count;
+    }
+
+    if (all && !MR_Cancelled()) {
+        qsort(all, total, sizeof(Ranked), compare_ranked_desc);
+        FILE *fp = fopen("result-top.txt", "w");
+        for (size_t i = 0; fp && i < total && i < top_k; i++) {
+            fprintf(fp, "%s: %s\n", all[i].key, all[i].value);
+        }
+        if (fp) fclose(fp);
+    }
+
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        for (unsigned int j = 0; j < top_heaps[i].count; j++) {
+            free(top_heaps[i].items[j].key);
+            free(top_heaps[i].items[j].value);
+        }
+        free(top_heaps[i].items);
+    }
+    free(all);
+    free(top_heaps);
+    top_heaps = NULL;
+}
+
+// Write a reduce result, by default as a "key: value" line of the result
+// file of the partition being reduced (or into its top-K heap)
+void MR_Output(char *key, char *value) {
+    if (output_fn) {
+        output_fn(key, value, reduce_partition);
+        return;
+    }
+    if (top_heaps) {
+        top_push(&top_heaps[reduce_partition], key, value);
+        return;
+    }
+    if (!reduce_out) {
+        char name[32];
+        snprintf(name, sizeof(name), "result-%u.txt", reduce_partition);
+        reduce_out = fopen(name, "a");
+        if (!reduce_out) return;
+    }
+    fprintf(reduce_out, "%s: %s\n", key, value);
+}
+
+// Move the record of a key out of a combining partition's table
+static void take_pair(char *key, char *value, void *ctx) {
+    Partition *partition = (Partition *)ctx;
+    KVPair *pair = malloc(sizeof(KVPair));
+    if (!pair) {
+        free(key);
+        free(value);
+        MR_Cancel();
+        return;
+    }
+    pair->key = key;
+    pair->value = value;
+    pair->tag = 0;
+    pair->mapped = false;
+    pair->next = partition->head;
+    partition->head = pair;
+}
+
+// Free the records of a partition
+static void free_pairs(Partition *partition) {
+    Table_free(partition->table);
+    partition->table = NULL;
+    KVPair *pair = partition->head;
+    partition->head = NULL;
+    while (pair) {
+        KVPair *next = pair->next;
+        free_pair(pair);
+        pair = next;
+    }
+}
+
 // Reduce job function
 // one reducer per partition that runs in a reducer thread
 void MR_Reduce(void *arg) {
@@ -149,88 +980,609 @@ void MR_Reduce(void *arg) {
     Reducer reduce_fn = reduce_args->reducer_fn;
     free(reduce_args);
 
+    // finished before a restart
+    if (partition_done && partition_done[idx]) return;
+
     Partition *partition = &partitions[idx];
+    reduce_partition = idx;
+    reduce_out = NULL;
 
-    while (partition->head) {
+    // a combining partition's records join the list, one per key
+    if (partition->table) {
+        Table_drain(partition->table, take_pair, partition);
+        partition->table = NULL;
+    }
+    if (!MR_Cancelled()) sort_partition(partition);
+    while (partition->head && !MR_Cancelled()) {
         char *key = strdup(partition->head->key);
         reduce_fn(key, idx);
         free(key);
     }
+
+    // a cancelled job drops what is left of the partition
+    free_pairs(partition);
+
+    if (reduce_out) {
+        if (partition_done) {
+            fflush(reduce_out);
+            fsync(fileno(reduce_out));
+        }
+        fclose(reduce_out);
+        reduce_out = NULL;
+    }
+    if (partition_done && !MR_Cancelled()) Checkpoint_mark_partition(checkpoint_dir, idx);
 }
 
-// Main MapReduce execution function
-void MR_Run(unsigned int file_count, char *file_names[],
-            Mapper mapper, Reducer reducer,
-            unsigned int num_workers, unsigned int num_parts) {
+// Set up empty partitions for a job
+void Core_init(Mapper mapper, unsigned int num_parts) {
     map_func = mapper;
     num_partitions = num_parts;
+    output_fn = NULL;
+    emit_fn = NULL;
+    map_tasks = NULL;
+    partition_done = NULL;
+    done_bytes = 0;
+    done_ns = 0;
+    done_count = 0;
+    losing_attempts = 0;
+    atomic_store(&tagged_job, false);
+    last_cancelled = false;
+    partition_keys = 0;
 
     partitions = malloc(num_parts * sizeof(Partition));
+    top_heaps = top_k && num_parts ? calloc(num_parts, sizeof(TopHeap)) : NULL;
 
     for (unsigned int i = 0; i < num_parts; i++) {
         partitions[i].head = NULL;
+        partitions[i].table = NULL;
         partitions[i].bytes = 0;
         pthread_mutex_init(&partitions[i].lock, NULL);
     }
+}
 
-    pool = ThreadPool_create(num_workers);
+// Track the map task of an input, releasing the input if out of memory
+static MapJob *map_job_create(InputFile *file) {
+    MapJob *job = calloc(1, sizeof(MapJob));
+    if (!job) {
+        Input_done(file);
+        return NULL;
+    }
+    job->file = file;
+    job->attempts = 1;
+    job->pending = 1;
 
-    // Map Phase: presort files by size and submit map jobs to thread pool
-    FileInfo *files = malloc(file_count * sizeof(FileInfo));
+    pthread_mutex_lock(&jobs_lock);
+    job->next = map_jobs;
+    map_jobs = job;
+    pthread_mutex_unlock(&jobs_lock);
+    return job;
+}
 
-    for (unsigned int i = 0; i < file_count; i++) {
-        struct stat st;
-        size_t sz = 0;
-        if (stat(file_names[i], &st) == 0) {
-            sz = (size_t)st.st_size;
-        }
-        files[i].name = file_names[i];
-        files[i].size = sz;
+// Submit a map job for an input that is ready to be read
+void Core_map_input(ThreadPool_t *tp, InputFile *file) {
+    MapJob *job = map_job_create(file);
+    if (!job) return;
+
+    if (!add_task(tp, map_wrapper, job, file->size)) {
+        job->done = true;
+        map_wrapper(job);
     }
-    
-    qsort(files, file_count, sizeof(FileInfo), compare_file_size);
-    
+}
 
-    for (unsigned int i = 0; i < file_count; i++) {
-        ThreadPool_add_job(pool, map_wrapper, files[i].name, files[i].size);
+// Add a record to a partition without copying its strings
+bool Core_add_mapped(unsigned int idx, char *key, char *value) {
+    Partition *partition = &partitions[idx];
+    bool ok = true;
+    if (partition_combine) {
+        // the table keeps copies of its own
+        pthread_mutex_lock(&partition->lock);
+        ok = partition_fold(partition, key, value);
+        pthread_mutex_unlock(&partition->lock);
+        return ok;
     }
+    KVPair *pair = malloc(sizeof(KVPair));
+    if (!pair) return false;
+    pair->key = key;
+    pair->value = value;
+    pair->tag = 0;
+    pair->mapped = true;
 
-    free(files);
+    pthread_mutex_lock(&partition->lock);
+    pair->next = partition->head;
+    partition->head = pair;
+    partition->bytes += strlen(key) + strlen(value) + 2;
+    pthread_mutex_unlock(&partition->lock);
+    return true;
+}
 
-    // Wait for all map jobs to complete
-    ThreadPool_check(pool);
+// Route MR_Output to fn instead of the result files
+void Core_set_output(OutputFn fn) {
+    output_fn = fn;
+}
+
+// Tag the records the calling thread emits
+void Core_set_tag(unsigned int tag) {
+    emit_tag = (unsigned char)tag;
+    atomic_store_explicit(&tagged_job, true, memory_order_relaxed);
+}
+
+// Route MR_Emit to fn instead of the partitions
+void Core_set_emit(EmitFn fn) {
+    emit_fn = fn;
+}
 
+// Reduce one partition on the calling thread
+void Core_reduce_partition(unsigned int idx, Reducer reducer) {
+    ReduceArgs *ra = malloc(sizeof(*ra));
+    if (!ra) return;
+    ra->partition_idx = idx;
+    ra->reducer_fn = reducer;
+    MR_Reduce(ra);
+    partitions[idx].bytes = 0;
+}
+
+// Drop the records of one partition
+void Core_clear_partition(unsigned int idx) {
+    free_pairs(&partitions[idx]);
+    partitions[idx].bytes = 0;
+}
+
+// Reduce every partition and wait for the reducers to finish, leaving the
+// partitions empty for the next batch of map output
+void Core_reduce(ThreadPool_t *tp, Reducer reducer) {
     // Reduce Phase: presort partitions by bytes and submit reduce jobs to thread pool
-    PartInfo *plist = malloc(num_parts * sizeof(PartInfo));
+    PartInfo *plist = malloc(num_partitions * sizeof(PartInfo));
 
-    for (unsigned int i = 0; i < num_parts; i++) {
+    for (unsigned int i = 0; i < num_partitions; i++) {
         plist[i].idx = i;
         plist[i].bytes = partitions[i].bytes;
     }
     
-    qsort(plist, num_parts, sizeof(PartInfo), compare_part_bytes);
+    qsort(plist, num_partitions, sizeof(PartInfo), compare_part_bytes);
     
     // Submit reduce jobs in sorted order
-    for (unsigned int k = 0; k < num_parts; k++) {
+    for (unsigned int k = 0; k < num_partitions; k++) {
         unsigned int idx = plist[k].idx;
         ReduceArgs *ra = malloc(sizeof(*ra));
         if (!ra) continue;
         ra->partition_idx = idx;
         ra->reducer_fn = reducer;
-        ThreadPool_add_job(pool, MR_Reduce, ra, partitions[idx].bytes);
+        add_task(tp, MR_Reduce, ra, partitions[idx].bytes);
     }
 
     free(plist);
 
     // Wait for all reduce jobs to complete
-    ThreadPool_check(pool);
+    wait_for_jobs(tp, false);
 
-    // Cleanup
-    ThreadPool_destroy(pool);
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        partitions[i].bytes = 0;
+    }
+}
 
-    for (unsigned int i = 0; i < num_parts; i++) {
+// Release the partitions, writing the results of top-K mode
+void Core_finish(void) {
+    if (top_heaps) top_finish();
+    for (unsigned int i = 0; i < num_partitions; i++) {
+        // partitions finished before a restart were never reduced
+        Table_free(partitions[i].table);
         pthread_mutex_destroy(&partitions[i].lock);
     }
 
     free(partitions);
-}
\ No newline at end of file
+    partitions = NULL;
+    num_partitions = 0;
+
+    // the token is cleared as the job ends, so that a cancel arriving before
+    // the next job starts still stops it
+    last_cancelled = atomic_exchange(&job_token.cancelled, false);
+}
+
+// Estimate the distinct keys of a job from a sample of the first of its
+// inputs that can be sampled, extrapolated to the size of all of them
+static double sample_job_keys(Mapper mapper, unsigned int count, char *names[]) {
+    double total_bytes = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(names[i], &st) == 0 && S_ISREG(st.st_mode)) total_bytes += st.st_size;
+    }
+    double keys = 0;
+    for (unsigned int i = 0; i < count && i < SAMPLE_TRIES && keys == 0; i++) {
+        keys = Core_sample_keys(mapper, names[i], total_bytes);
+    }
+    return keys;
+}
+
+// Main MapReduce execution function
+void MR_Run(unsigned int file_count, char *file_names[],
+            Mapper mapper, Reducer reducer,
+            unsigned int num_workers, unsigned int num_parts) {
+    Core_init(mapper, num_parts);
+
+    pool = ThreadPool_create(num_workers);
+
+    // Checkpointing: find the partitions an earlier attempt finished
+    bool all_done = false;
+    if (checkpoint_dir) {
+        bool resumed = Checkpoint_open(checkpoint_dir, checkpoint_resume, num_parts,
+                                       file_count, file_names);
+        partition_done = calloc(num_parts, sizeof(bool));
+        all_done = resumed;
+        for (unsigned int i = 0; i < num_parts; i++) {
+            partition_done[i] = resumed && Checkpoint_partition_done(checkpoint_dir, i);
+            all_done = all_done && partition_done[i];
+        }
+    }
+
+    // Incremental runs and restarts: load the stored output of unchanged or
+    // already mapped inputs and only map the others
+    char **to_map = malloc(file_count * sizeof(char *));
+    MapTask *tasks = calloc(file_count, sizeof(MapTask));   // by InputFile index
+    MapTask *cached = calloc(file_count, sizeof(MapTask));  // loaded instead
+    unsigned int map_count = 0, cached_count = 0;
+    char *job = cache_dir || checkpoint_dir ? Cache_job((const void *)mapper, cache_job) : NULL;
+
+    for (unsigned int i = 0; i < file_count && !all_done; i++) {
+        CacheEntry saved = { 0 }, entry = { 0 };
+        bool hit = checkpoint_dir && job &&
+                   Cache_lookup(checkpoint_dir, file_names[i], false, job, &saved);
+        if (!hit && cache_dir && job) {
+            hit = Cache_lookup(cache_dir, file_names[i], cache_hash, job, &entry);
+        }
+        if (hit) {
+            MapTask *task = &cached[cached_count++];
+            task->cache = entry;
+            task->checkpoint = saved;
+            RunReader *reader = saved.reader.map ? &task->checkpoint.reader : &task->cache.reader;
+            add_task(pool, cache_load_job, reader, reader->len);
+            continue;
+        }
+        tasks[map_count].cache = entry;
+        tasks[map_count].checkpoint = saved;
+        to_map[map_count++] = file_names[i];
+    }
+    free(job);
+    map_tasks = cache_dir || checkpoint_dir ? tasks : NULL;
+
+    // combining partitions start sized for their share of the keys that a
+    // sample of the inputs extrapolates to, within TABLE_MAX_PRESIZE
+    if (partition_combine && num_parts > 0) {
+        double keys = sample_job_keys(mapper, map_count, to_map) / num_parts;
+        partition_keys = keys < TABLE_MAX_PRESIZE ? (size_t)keys : TABLE_MAX_PRESIZE;
+    }
+
+    // Map Phase: decompress inputs as needed and submit a map job per file
+    // (or per block of a pipe input)
+    InputFile *files = malloc(map_count * sizeof(InputFile));
+    Input_prepare(pool, map_count, to_map, files, submit_map_job, pool);
+
+    // Wait for all map jobs to complete, duplicating stragglers once the
+    // queue has drained; attempts that lost their task are left to finish
+    // in the background
+    wait_for_jobs(pool, true);
+
+    map_tasks = NULL;
+    for (unsigned int i = 0; i < map_count; i++) {
+        Cache_release(&tasks[i].cache);
+        Cache_release(&tasks[i].checkpoint);
+    }
+    for (unsigned int i = 0; i < cached_count; i++) {
+        Cache_release(&cached[i].cache);
+        Cache_release(&cached[i].checkpoint);
+    }
+    free(tasks);
+    free(cached);
+
+    // a partition reduced again after a restart replaces its partial
+    // results, even if it now writes none
+    for (unsigned int i = 0; partition_done && !top_heaps && i < num_parts; i++) {
+        if (partition_done[i]) continue;
+        char name[32];
+        snprintf(name, sizeof(name), "result-%u.txt", i);
+        if (truncate(name, 0) != 0 && errno != ENOENT) MR_Cancel();
+    }
+
+    Core_reduce(pool, reducer);
+
+
+    // Cleanup (losing map attempts read their input until they finish)
+    ThreadPool_destroy(pool);
+    Input_release(files, map_count);
+    free(files);
+    free(to_map);
+    if (partition_done) {
+        // the job is complete, so its checkpoints are no longer needed (a
+        // cancelled job keeps them to resume from)
+        if (!MR_Cancelled()) Checkpoint_clear(checkpoint_dir);
+        free(partition_done);
+        partition_done = NULL;
+    }
+    Core_finish();
+}
+
+// Map job of a map-only job: the mapper writes straight to the task's output
+static void map_only_job(void *arg) {
+    MapOnlyTask *task = (MapOnlyTask *)arg;
+    if (!MR_Cancelled()) {
+        map_only_task = task;
+        map_func(task->file->path);
+        map_only_task = NULL;
+    }
+    if (task->out) fclose(task->out);
+    Input_done(task->file);
+    free(task);
+}
+
+// Submit the map job of an input of a map-only job
+static void submit_map_only_job(InputFile *file, void *ctx) {
+    MapOnlyTask *task = calloc(1, sizeof(MapOnlyTask));
+    if (!task) {
+        Input_done(file);
+        return;
+    }
+    task->file = file;
+    // blocks are handed out one at a time from the thread reading the pipe
+    task->task = file->block ? map_only_inputs + map_only_blocks++ : file->index;
+    if (!add_task((ThreadPool_t *)ctx, map_only_job, task, file->size)) {
+        map_only_job(task);
+    }
+}
+
+// Map-only execution function
+void MR_RunMapOnly(unsigned int file_count, char *file_names[], Mapper mapper,
+                   MapSink sink, void *ctx, unsigned int num_workers) {
+    Core_init(mapper, 0);
+    map_only = true;
+    map_sink = sink;
+    map_sink_ctx = ctx;
+    map_only_inputs = file_count;
+    map_only_blocks = 0;
+
+    pool = ThreadPool_create(num_workers);
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    if (files) {
+        Input_prepare(pool, file_count, file_names, files, submit_map_only_job, pool);
+        wait_for_jobs(pool, false);
+    }
+
+    ThreadPool_destroy(pool);
+    if (files) Input_release(files, file_count);
+    free(files);
+    map_only = false;
+    map_sink = NULL;
+    map_sink_ctx = NULL;
+    Core_finish();
+}
+
+// Drop the results of a dry run
+static void discard_output(char *key, char *value, unsigned int partition_idx) {
+}
+
+// Estimate distinct keys of all inputs from those of the sample: distinct
+// keys grow with the records as a power between 0 (no new keys) and 1 (all
+// new), fitted to the keys of all records and of the early ones of each task
+static double extrapolate_keys(const SampleStats *stats, unsigned int count, double scale) {
+    HyperLogLog *all = Hll_create(ESTIMATE_HLL_PRECISION);
+    HyperLogLog *early = Hll_create(ESTIMATE_HLL_PRECISION);
+    if (!all || !early) {
+        Hll_free(all);
+        Hll_free(early);
+        return 0;
+    }
+    size_t records = 0, early_records = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        Hll_merge(all, stats[i].keys);
+        Hll_merge(early, stats[i].early);
+        records += stats[i].records;
+        early_records += stats[i].early_records;
+    }
+    double keys = Hll_estimate(all), early_keys = Hll_estimate(early);
+    Hll_free(all);
+    Hll_free(early);
+
+    double growth = 1;
+    if (early_keys >= 1 && early_records > 0 && early_records < records) {
+        growth = log(keys / early_keys) / log((double)records / early_records);
+        if (growth < 0) growth = 0;
+        if (growth > 1) growth = 1;
+    }
+    return keys * pow(scale, growth);
+}
+
+// Estimate the distinct keys a mapper emits over some bytes of inputs like
+// one, from the first lines of it
+double Core_sample_keys(Mapper mapper, const char *name, double total_bytes) {
+    InputFile block;
+    if (!Input_sample(name, 0, SAMPLE_BYTES, &block)) return 0;
+    SampleStats stats = { 0, 0, Hll_create(ESTIMATE_HLL_PRECISION),
+                          Hll_create(ESTIMATE_HLL_PRECISION), 0 };
+    double keys = 0;
+    if (stats.keys && stats.early) {
+        key_sample = &stats;
+        mapper(block.path);
+        key_sample = NULL;
+        keys = extrapolate_keys(&stats, 1, total_bytes / block.size);
+    }
+    Hll_free(stats.keys);
+    Hll_free(stats.early);
+    Input_done(&block);
+    return keys;
+}
+
+// Map job of a sampled byte range: copy its lines, then map them as a task
+static void sample_range_job(void *arg) {
+    SampleRange *range = (SampleRange *)arg;
+    if (MR_Cancelled() ||
+        !Input_sample(range->name, range->offset, ESTIMATE_RANGE_BYTES, &range->block)) {
+        return;
+    }
+    range->block.index = range->index;
+    range->bytes = range->block.size;
+    MapJob *job = map_job_create(&range->block);
+    if (job) map_wrapper(job);
+}
+
+// Estimate a job from a dry run over a sample of its inputs
+bool MR_Estimate(unsigned int file_count, char *file_names[], Mapper mapper, Reducer reducer,
+                 double fraction, unsigned int num_workers, unsigned int num_parts,
+                 JobEstimate *estimate) {
+    // only regular files can be sampled, and extrapolated from by size:
+    // plain ones larger than their share of the sample in byte ranges, the
+    // others (small or compressed) whole
+    unsigned int *whole = malloc((file_count + 1) * sizeof(unsigned int));
+    off_t *sizes = malloc((file_count + 1) * sizeof(off_t));
+    char **sample = malloc((file_count + 1) * sizeof(char *));
+    SampleRange *ranges = NULL;
+    size_t range_count = 0, range_cap = 0;
+    unsigned int count = 0, whole_count = 0, cut = 0;
+    size_t total_bytes = 0;
+    unsigned int seed = (unsigned int)now_ns() ^ (unsigned int)getpid();
+    bool ok = whole && sizes && sample;
+    for (unsigned int i = 0; ok && i < file_count; i++) {
+        struct stat st;
+        if (stat(file_names[i], &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        count++;
+        total_bytes += st.st_size;
+        size_t n = (size_t)ceil(fraction * st.st_size / ESTIMATE_RANGE_BYTES);
+        if (n == 0) n = 1;
+        if (n * ESTIMATE_RANGE_BYTES >= (size_t)st.st_size ||
+            Input_format(file_names[i]) != INPUT_PLAIN) {
+            sizes[whole_count] = st.st_size;
+            whole[whole_count++] = i;
+            continue;
+        }
+        if (range_count + n > range_cap) {
+            size_t cap = range_cap ? range_cap * 2 : 64;
+            while (cap < range_count + n) cap *= 2;
+            SampleRange *grown = realloc(ranges, cap * sizeof(SampleRange));
+            ok = grown != NULL;
+            if (!ok) break;
+            ranges = grown;
+            range_cap = cap;
+        }
+        // a range at a random offset in each of n equal stretches of the file
+        double stretch = (double)st.st_size / n;
+        uint64_t slack = stretch > ESTIMATE_RANGE_BYTES + 1 ? (uint64_t)(stretch - ESTIMATE_RANGE_BYTES) : 1;
+        for (size_t k = 0; k < n; k++) {
+            uint64_t r = (uint64_t)rand_r(&seed) << 31 | (uint64_t)rand_r(&seed);
+            off_t offset = (off_t)(k * stretch) + (off_t)(r % slack);
+            if (offset + ESTIMATE_RANGE_BYTES >= st.st_size) {
+                offset = st.st_size - ESTIMATE_RANGE_BYTES - 1;
+            }
+            SampleRange *range = &ranges[range_count++];
+            memset(range, 0, sizeof(*range));
+            range->name = file_names[i];
+            range->offset = offset;
+        }
+        cut++;
+    }
+    if (!ok || count == 0 || num_parts == 0) {
+        free(whole);
+        free(sizes);
+        free(sample);
+        free(ranges);
+        return false;
+    }
+
+    // the files sampled whole: a random subset of them
+    unsigned int want = (unsigned int)ceil(fraction * whole_count);
+    if (want < 1 && range_count == 0) want = 1;
+    if (want > whole_count) want = whole_count;
+    size_t sample_bytes = 0;
+    for (unsigned int i = 0; i < want; i++) {
+        unsigned int j = i + rand_r(&seed) % (whole_count - i);
+        unsigned int index = whole[j];
+        off_t size = sizes[j];
+        whole[j] = whole[i];
+        sizes[j] = sizes[i];
+        whole[i] = index;
+        sizes[i] = size;
+        sample[i] = file_names[index];
+        sample_bytes += size;
+    }
+    for (size_t k = 0; k < range_count; k++) {
+        ranges[k].index = want + (unsigned int)k;
+    }
+
+    // map and reduce the sample as the job would, keeping no results
+    size_t tasks = want + range_count;
+    Core_init(mapper, num_parts);
+    Core_set_output(discard_output);
+    sample_stats = calloc(tasks, sizeof(SampleStats));
+    ok = sample_stats != NULL;
+    for (size_t i = 0; ok && i < tasks; i++) {
+        sample_stats[i].keys = Hll_create(ESTIMATE_HLL_PRECISION);
+        sample_stats[i].early = Hll_create(ESTIMATE_HLL_PRECISION);
+        ok = sample_stats[i].keys && sample_stats[i].early;
+    }
+    InputFile *files = malloc((want + 1) * sizeof(InputFile));
+    pool = ThreadPool_create(num_workers);
+    long long reduce_ns = 0;
+    if (ok && files) {
+        Input_prepare(pool, want, sample, files, submit_map_job, pool);
+        for (size_t k = 0; k < range_count; k++) {
+            if (!add_task(pool, sample_range_job, &ranges[k], ESTIMATE_RANGE_BYTES)) {
+                sample_range_job(&ranges[k]);
+            }
+        }
+        wait_for_jobs(pool, false);
+        long long start = now_ns();
+        Core_reduce(pool, reducer);
+        reduce_ns = now_ns() - start;
+    }
+    ThreadPool_destroy(pool);
+    if (ok && files) Input_release(files, want);
+    ok = ok && files && done_count > 0 && !MR_Cancelled();
+
+    if (ok) {
+        // scale what the sample emitted to all inputs by size
+        for (size_t k = 0; k < range_count; k++) {
+            sample_bytes += ranges[k].bytes;
+        }
+        double scale = sample_bytes > 0 ? (double)total_bytes / sample_bytes
+                                        : (double)count / (want + cut);
+        size_t records = 0, bytes = 0;
+        for (size_t i = 0; i < tasks; i++) {
+            records += sample_stats[i].records;
+            bytes += sample_stats[i].bytes;
+        }
+        memset(estimate, 0, sizeof(JobEstimate));
+        estimate->inputs_sampled = want + cut;
+        estimate->sample_fraction = total_bytes > 0 ? (double)sample_bytes / total_bytes
+                                                    : (double)(want + cut) / count;
+        estimate->records = records * scale;
+        estimate->shuffle_bytes = bytes * scale;
+        estimate->distinct_keys = extrapolate_keys(sample_stats, (unsigned int)tasks, scale);
+        if (estimate->distinct_keys > estimate->records) estimate->distinct_keys = estimate->records;
+
+        // map tasks run side by side; sorting a partition takes n log n
+        estimate->map_seconds = done_ns / 1e9 * scale / (num_workers ? num_workers : 1);
+        double per_part = (double)records / num_parts;
+        double full_per_part = estimate->records / num_parts;
+        estimate->reduce_seconds = per_part >= 1
+            ? reduce_ns / 1e9 * (full_per_part * log2(full_per_part + 2)) / (per_part * log2(per_part + 2))
+            : 0;
+
+        // every record holds a pair and copies of its key and value
+        estimate->memory_bytes = estimate->records * (sizeof(KVPair) + 3 * ESTIMATE_MALLOC_OVERHEAD) +
+                                 estimate->shuffle_bytes;
+        double parts = ceil(estimate->memory_bytes / ESTIMATE_PART_BYTES);
+        if (parts < num_workers) parts = num_workers;
+        if (parts > estimate->distinct_keys) parts = estimate->distinct_keys;
+        estimate->num_parts = parts < 1 ? 1 : (unsigned int)parts;
+    }
+
+    for (size_t i = 0; sample_stats && i < tasks; i++) {
+        Hll_free(sample_stats[i].keys);
+        Hll_free(sample_stats[i].early);
+    }
+    free(sample_stats);
+    sample_stats = NULL;
+    free(files);
+    free(whole);
+    free(sizes);
+    free(sample);
+    free(ranges);
+    Core_finish();
+    return ok;
+}
@@ -0,0 +1,288 @@
+// Optional extensions to the MapReduce API. mapreduce.h is held constant,
+// so features beyond it are declared here.
+#ifndef MAPREDUCE_EXT_H
+#define MAPREDUCE_EXT_H
+#include "mapreduce.h"
+#include "mrtable.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+* Set the size of the blocks that pipe inputs are cut into. File names
+* passed to MR_Run that refer to stdin ("-"), a FIFO or another stream are
+* read by the framework and each line-aligned block is mapped as it arrives.
+* Parameters:
+*     bytes - Block size (default 4 MiB); blocks end on a line boundary
+*/
+void MR_SetBlockSize(size_t bytes);
+
+/**
+* Enable incremental runs. The map output of every regular input file is
+* stored in dir, keyed by the file's path, size and mtime (and a hash of
+* its contents if hash_contents is set) and by the job: its map function
+* (where it is in the program, and the program's ELF build-id, or the size
+* and mtime of the program file if it has none, so a rebuild invalidates
+* the cache) and the identity job gives it. Later runs of the same job
+* load the stored output of unchanged files into the shuffle instead of
+* mapping them again; other jobs sharing dir keep outputs of their own.
+* Only the map phase is saved: the stored records are still shuffled and
+* every partition is reduced again, so a rerun costs about what the
+* shuffle and reduce of the whole job cost, plus mapping the changed
+* inputs.
+* Parameters:
+*     dir           - Cache directory (created if missing), or NULL to disable
+*     hash_contents - Whether to also require unchanged contents
+*     job           - Identity of the job, covering anything its map output
+*                     depends on besides the mapper and the input (e.g.
+*                     options the mapper reads), or NULL
+* Note: the mapper must be deterministic and only emit through MR_Emit.
+*       Settings applied after the map phase (key and value orders,
+*       MR_SetPartitionCombine, partition counts) do not change the map
+*       output, so runs differing only in them share it.
+*/
+void MR_SetCache(const char *dir, bool hash_contents, const char *job);
+
+/**
+* Enable checkpointing. Each map task durably stores its output in dir and
+* each reduce partition records its completion there, so that after a
+* crash a rerun of the same job with resume set loads the stored map output
+* instead of remapping and skips the finished partitions. The checkpoints
+* are removed once MR_Run completes.
+* Parameters:
+*     dir    - Checkpoint directory of the job, or NULL to disable
+*     resume - Whether to use the checkpoints of an earlier attempt
+* Note: the result files MR_Output writes for partitions that rerun are
+*       emptied as the reduce phase starts, so none keeps records of an
+*       earlier attempt; reducers writing their own output should do the
+*       same
+*/
+void MR_SetCheckpoint(const char *dir, bool resume);
+
+/**
+* Enable speculative execution of map tasks. Once the job queue is empty
+* and workers are idle, MR_Run starts a second attempt of any running map
+* task that has taken slowdown times longer than the finished tasks' bytes
+* per second predict. The output of the first attempt to finish is kept and
+* the other's is discarded, so each attempt buffers its emits until it ends.
+* The attempt that loses sees MR_Cancelled and its emits are dropped, so a
+* mapper polling MR_Cancelled stops as soon as the other attempt wins.
+* Parameters:
+*     slowdown - How far behind a task must be (e.g. 2.0), or 0 to disable
+* Note: the mapper must be deterministic and only emit through MR_Emit
+*/
+void MR_SetSpeculation(double slowdown);
+
+/**
+* Compare two keys
+* Return:
+*     int - Negative, zero or positive as a orders before, with or after b;
+*           zero puts both in the same group
+*/
+typedef int (*KeyComparator)(const char *a, const char *b);
+
+/**
+* Hash a key for partitioning; keys a comparator finds equal must hash alike
+*/
+typedef unsigned long (*KeyHash)(const char *key);
+
+/**
+* Built-in key orders. MR_CompareNumeric orders keys by their value as
+* strtod reads it (keys that are not numbers last), and keys of equal
+* value as strings; MR_CompareCaseless ignores case, grouping keys that
+* differ only in case under the first of them; MR_CompareReverse orders
+* keys as strcmp does, descending.
+*/
+int MR_CompareNumeric(const char *a, const char *b);
+int MR_CompareCaseless(const char *a, const char *b);
+int MR_CompareReverse(const char *a, const char *b);
+
+// Estimate of a job, extrapolated from a dry run over a sample of its inputs
+typedef struct {
+    unsigned int inputs_sampled;  // inputs mapped, whole or in part
+    double sample_fraction;       // share of the input bytes they hold
+    double records;               // records the mapper would emit
+    double shuffle_bytes;         // bytes of their keys and values
+    double distinct_keys;         // distinct keys among them
+    double map_seconds;           // time of the map phase
+    double reduce_seconds;        // time of the reduce phase (sort and reducer)
+    double memory_bytes;          // memory the partitions would hold at the barrier
+    unsigned int num_parts;       // partitions to use: enough to keep each under
+                                  // 64 MiB and every worker busy
+} JobEstimate;
+
+/**
+* Estimate the cost of a job before running it: map a random sample of its
+* input bytes with its mapper and reduce the result with its reducer,
+* discarding the results, while measuring the records, bytes and distinct
+* keys emitted and the time each phase takes. Plain inputs are sampled as
+* 1 MiB ranges of whole lines at random offsets, spread over each file;
+* inputs too small to cut into ranges, and compressed ones, are sampled as
+* a random subset of whole files. Counts are extrapolated to all inputs by
+* bytes, distinct keys by how fast they grew over the sample, and the
+* reduce phase as sorting n records takes n log n.
+* Parameters:
+*     file_count  - Number of files (i.e. input splits)
+*     file_names  - Array of filenames
+*     mapper      - Function pointer to the map function
+*     reducer     - Function pointer to the reduce function
+*     fraction    - Share of the input bytes to map (at least one range or
+*                   file is)
+*     num_workers - Number of threads the job would run on
+*     num_parts   - Number of partitions the job would use
+*     estimate    - Filled in with the estimate
+* Return:
+*     true  - On success
+*     false - If no input could be sampled (only regular files are, so
+*             streams are not consumed) or the dry run was cancelled
+* Note: the reducer should write with MR_Output, which the dry run ignores
+*/
+bool MR_Estimate(unsigned int file_count, char *file_names[], Mapper mapper, Reducer reducer,
+                 double fraction, unsigned int num_workers, unsigned int num_parts,
+                 JobEstimate *estimate);
+
+/**
+* Set the order in which keys reach the reducers, and which keys form a
+* group. The built-in orders are sorted by code specialized to each, with
+* no call through a pointer per comparison; other comparators are called
+* for every comparison.
+* Parameters:
+*     compare - Key order: a built-in one, another comparator, or NULL for
+*               strcmp
+*     hash    - Hash placing keys in partitions, or NULL for
+*               MR_Partitioner's (which folds case for MR_CompareCaseless);
+*               needed when compare finds keys with different bytes equal
+* Note: applies to every engine built on MR_Run's partitions, and keys are
+*       ordered within each partition, not across them
+*/
+void MR_SetKeyOrder(KeyComparator compare, KeyHash hash);
+
+/**
+* Compare two values of the same key
+* Return:
+*     int - Negative, zero or positive as a orders before, with or after b
+*/
+typedef int (*ValueComparator)(const char *a, const char *b);
+
+/**
+* Sort the values of each key (secondary sort). The shuffle orders the
+* values of a key with compare as it orders the keys, so MR_GetNext
+* returns them in that order and a reducer needing ordered values (e.g.
+* events by time) can stream a group of any size instead of buffering it.
+* Parameters:
+*     compare - Value order, or NULL to return values in no set order
+* Note: applies to every engine built on MR_Run's partitions; values a
+*       comparator finds equal come in no set order
+*/
+void MR_SetValueOrder(ValueComparator compare);
+
+/**
+* Make partitions combine on insert: the records of a key are folded into
+* one with combine as they reach their partition, which by the end of the
+* map phase holds a single record per distinct key, so its memory follows
+* the number of keys rather than of records. The reducer then receives
+* the combined value of each key (usually one, more if keys a custom key
+* order finds equal differ in bytes), so it must read its values as
+* partial results (e.g. add them up instead of counting them). MR_Run
+* first maps the first 256 KiB of an input into a HyperLogLog and sizes
+* each partition's table for its share of the keys this extrapolates to
+* (up to TABLE_MAX_PRESIZE); what the mapper does besides MR_Emit happens
+* twice for those lines.
+* Parameters:
+*     combine - Associative, commutative fold of two values of a key, or
+*               NULL to keep every record
+* Note: applies to every engine built on MR_Run's partitions, except for
+*       jobs tagging their records (MR_RunJoin and dataflows), which keep
+*       every record
+*/
+void MR_SetPartitionCombine(TableCombine combine);
+
+/**
+* Keep only the k best results. MR_Output then feeds a heap of at most k
+* results per partition instead of the result files, and once the job ends
+* the heaps are merged into result-top.txt: k "key: value" lines, best
+* first, with ties going to the smaller key.
+* Parameters:
+*     k       - Number of results to keep, or 0 to write every result
+*     compare - Order of the results' values, greatest best, or NULL to
+*               compare them as numbers
+* Note: applies to the engines writing result files through MR_Output
+*       (MR_Run, MR_RunJoin, the last stage of MR_RunPipeline); not to be
+*       combined with MR_SetCheckpoint, as partitions finished before a
+*       restart are not reduced again
+*/
+void MR_SetTopK(unsigned int k, ValueComparator compare);
+
+/**
+* Limit the time each map and reduce task may run. A task still running
+* after ms milliseconds cancels the whole job, as MR_Cancel does. In
+* cluster mode (MR_RunCluster) the worker process running it is killed
+* instead, and the task is retried as a crashed worker's task would be.
+* Parameters:
+*     ms - Time limit per task, or 0 for no limit
+*/
+void MR_SetTaskTimeout(unsigned int ms);
+
+/**
+* Cancel the MR_Run in progress. Queued tasks are skipped, MR_Emit drops
+* records, and each reduce task frees its partition instead of reducing
+* it, so MR_Run returns as soon as the running map and reduce functions
+* do. Mappers and reducers should poll MR_Cancelled to return early.
+* Called between jobs, it cancels the next one as soon as it starts.
+* Safe to call from any thread or from a signal handler.
+*/
+void MR_Cancel(void);
+
+/**
+* Check whether the job is cancelled
+* Return:
+*     true  - If MR_Cancel was called or a task ran past its timeout
+*             (after MR_Run returns: whether the job was cancelled, in
+*             which case its results are incomplete); in a mapper, also
+*             if another attempt of its task has won (MR_SetSpeculation)
+*     false - Otherwise
+*/
+bool MR_Cancelled(void);
+
+/**
+* Write a result from a reducer. MR_Run appends a "key: value" line to
+* result-<partition>.txt; other engines (e.g. MR_Stream) collect the
+* results instead.
+* Parameters:
+*     key   - Key being reduced
+*     value - Result for the key
+*/
+void MR_Output(char *key, char *value);
+
+/**
+* Receive a record emitted by the mapper of a map-only job
+* Parameters:
+*     key   - Key of the record
+*     value - Value of the record
+*     task  - Map task that emitted it: the position of its input in
+*             file_names, or for the blocks of a pipe input, file_count
+*             onwards in the order they were read
+*     ctx   - Passed through from MR_RunMapOnly
+*/
+typedef void (*MapSink)(const char *key, const char *value, unsigned int task, void *ctx);
+
+/**
+* Run a job that has no reduce phase. Nothing is partitioned, sorted or
+* held: every record the mapper emits with MR_Emit goes straight to the
+* output of its map task, by default a "key: value" line of
+* result-<task>.txt (rewritten by each run).
+* Parameters:
+*     file_count  - Number of files (i.e. input splits)
+*     file_names  - Array of filenames
+*     mapper      - Function pointer to the map function
+*     sink        - Receives the records instead of the result files, or
+*                   NULL; the calls of one task come from one thread, those
+*                   of different tasks concurrently
+*     ctx         - Passed through to sink
+*     num_workers - Number of threads in the thread pool
+* Note: MR_Cancel and MR_SetTaskTimeout apply; incremental runs,
+*       checkpoints and speculation do not
+*/
+void MR_RunMapOnly(unsigned int file_count, char *file_names[], Mapper mapper,
+                   MapSink sink, void *ctx, unsigned int num_workers);
+
+#endif
@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include "mraggregate.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrcounter.h"
+#include "mrhll.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Precision of the estimators of the keys of each table (about 1.6% error)
+#define KEYS_HLL_PRECISION 12
+
+// Table of a map task or of a merge, with an estimator of its keys, from
+// which merges size their result before moving entries over
+typedef struct {
+    KVTable *table;
+    HyperLogLog *keys;
+} Partial;
+
+// Two tables of a level of the tree, merged by one job
+typedef struct {
+    Partial into;  // the merged table once the job is done
+    Partial from;
+} MergeArgs;
+
+// An entry of the result, with its partition
+typedef struct {
+    const char *key;
+    const char *value;
+    unsigned int partition;
+} ResultEntry;
+
+typedef struct {
+    ResultEntry *entries;
+    size_t count;
+    unsigned int num_parts;
+} Results;
+
+// Global variables
+static Mapper user_mapper = NULL;
+static TableCombine combine_fn = NULL;
+static Partial *partials = NULL;  // table of every finished map task
+static size_t partial_count = 0;
+static size_t partial_cap = 0;
+static pthread_mutex_t partials_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t task_keys = 0;       // most keys a finished map task held
+static double task_key_rate = 0;   // most keys per input byte of one
+
+// Table of the map task running on this thread
+static __thread Partial *task_partial = NULL;
+
+// Counter jobs: the map every map task updates
+static CounterMap *counters = NULL;
+
+static void partial_free(Partial *partial) {
+    Table_free(partial->table);
+    Hll_free(partial->keys);
+}
+
+// Emit function: fold the record into the map task's table
+static void aggregate_emit(char *key, char *value, unsigned int partition_idx) {
+    if (!task_partial) return;
+    size_t keys = Table_count(task_partial->table);
+    // out of memory: the results would be incomplete
+    if (!Table_add(task_partial->table, key, value, combine_fn)) MR_Cancel();
+    if (Table_count(task_partial->table) > keys) Hll_add(task_partial->keys, key);
+}
+
+// Keys a map task is expected to hold: at the densest rate of the tasks
+// done so far, but no more than the largest of them held, or before any is
+// done, extrapolated from a sample of the input; never more than
+// TABLE_MAX_PRESIZE
+static size_t expected_keys(const char *file_name, double size) {
+    pthread_mutex_lock(&partials_lock);
+    bool first_wave = partial_count == 0;
+    double keys = task_key_rate * size;
+    if (keys > task_keys) keys = task_keys;
+    pthread_mutex_unlock(&partials_lock);
+    if (first_wave) keys = Core_sample_keys(user_mapper, file_name, size);
+    return keys < TABLE_MAX_PRESIZE ? (size_t)keys : TABLE_MAX_PRESIZE;
+}
+
+// Map function: map the input into a table of its own, sized for the keys
+// it is expected to yield
+static void aggregate_map(char *file_name) {
+    struct stat st;
+    double size = stat(file_name, &st) == 0 ? (double)st.st_size : 0;
+    Partial partial = { Table_create(expected_keys(file_name, size)),
+                        Hll_create(KEYS_HLL_PRECISION) };
+    // a table too large for memory may only be a wrong estimate
+    if (!partial.table) partial.table = Table_create(0);
+    if (!partial.table || !partial.keys) {
+        partial_free(&partial);
+        MR_Cancel();
+        return;
+    }
+    task_partial = &partial;
+    user_mapper(file_name);
+    task_partial = NULL;
+
+    size_t keys = Table_count(partial.table);
+    double rate = size > 0 ? keys / size : 0;
+
+    pthread_mutex_lock(&partials_lock);
+    if (keys > task_keys) task_keys = keys;
+    if (rate > task_key_rate) task_key_rate = rate;
+    if (partial_count == partial_cap) {
+        size_t cap = partial_cap ? partial_cap * 2 : 64;
+        Partial *grown = realloc(partials, cap * sizeof(Partial));
+        if (grown) {
+            partials = grown;
+            partial_cap = cap;
+        }
+    }
+    bool kept = partial_count < partial_cap;
+    if (kept) partials[partial_count++] = partial;
+    pthread_mutex_unlock(&partials_lock);
+    if (!kept) {
+        partial_free(&partial);
+        MR_Cancel();
+    }
+}
+
+// Merge job: fold the smaller table into the larger, first sized for the
+// estimated keys of both so that it grows at most once
+static void merge_job(void *arg) {
+    MergeArgs *args = (MergeArgs *)arg;
+    if (Table_count(args->from.table) > Table_count(args->into.table)) {
+        Partial swap = args->into;
+        args->into = args->from;
+        args->from = swap;
+    }
+    Hll_merge(args->into.keys, args->from.keys);
+    Hll_free(args->from.keys);
+    args->from.keys = NULL;
+
+    // a little over the estimate, but never more than both tables hold
+    size_t most = Table_count(args->into.table) + Table_count(args->from.table);
+    double keys = Hll_estimate(args->into.keys) * (1 + 2 * Hll_error(args->into.keys));
+    bool ok = Table_reserve(args->into.table, keys < most ? (size_t)keys : most);
+    if (!Table_merge(args->into.table, args->from.table, combine_fn) || !ok) MR_Cancel();
+    args->from.table = NULL;
+}
+
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
+}
+
+static void collect_entry(const char *key, const char *value, void *ctx) {
+    Results *results = (Results *)ctx;
+    ResultEntry *entry = &results->entries[results->count++];
+    entry->key = key;
+    entry->value = value;
+    entry->partition = MR_Partitioner((char *)key, results->num_parts);
+}
+
+// Order of results: by partition, then in the key order
+static int compare_entries(const void *a, const void *b) {
+    const ResultEntry *x = (const ResultEntry *)a, *y = (const ResultEntry *)b;
+    if (x->partition != y->partition) return x->partition < y->partition ? -1 : 1;
+    return Core_compare_keys(x->key, y->key);
+}
+
+// Write the merged table as result files
+static void write_results(KVTable *table, unsigned int num_parts) {
+    Results results = { malloc((Table_count(table) + 1) * sizeof(ResultEntry)), 0, num_parts };
+    if (!results.entries) return;
+    Table_foreach(table, collect_entry, &results);
+    qsort(results.entries, results.count, sizeof(ResultEntry), compare_entries);
+
+    FILE *fp = NULL;
+    for (size_t i = 0; i < results.count; i++) {
+        ResultEntry *entry = &results.entries[i];
+        if (i == 0 || entry->partition != results.entries[i - 1].partition) {
+            if (fp) fclose(fp);
+            char name[32];
+            snprintf(name, sizeof(name), "result-%u.txt", entry->partition);
+            fp = fopen(name, "a");
+        }
+        if (fp) fprintf(fp, "%s: %s\n", entry->key, entry->value);
+    }
+    if (fp) fclose(fp);
+    free(results.entries);
+}
+
+// Merge the map tasks' tables pairwise, one level of the tree at a time
+static KVTable *merge_tree(ThreadPool_t *pool) {
+    size_t n = partial_count;
+    MergeArgs *args = malloc((n / 2 + 1) * sizeof(MergeArgs));
+    if (!args) return NULL;
+    while (n > 1 && !MR_Cancelled()) {
+        for (size_t i = 0; i < n / 2; i++) {
+            args[i].into = partials[2 * i];
+            args[i].from = partials[2 * i + 1];
+            Core_add_task(pool, merge_job, &args[i],
+                          Table_count(args[i].into.table) + Table_count(args[i].from.table));
+        }
+        Core_wait(pool);
+        for (size_t i = 0; i < n / 2; i++) {
+            partials[i] = args[i].into;
+        }
+        if (n % 2) partials[n / 2] = partials[n - 1];
+        n = (n + 1) / 2;
+    }
+    free(args);
+    partial_count = n;
+    return n == 1 && !MR_Cancelled() ? partials[0].table : NULL;
+}
+
+// Main aggregation execution function
+void MR_RunAggregate(unsigned int file_count, char *file_names[], Mapper mapper,
+                     TableCombine combine, unsigned int num_workers, unsigned int num_parts) {
+    user_mapper = mapper;
+    combine_fn = combine;
+    task_keys = 0;
+    task_key_rate = 0;
+    Core_init(aggregate_map, 1);
+    Core_set_emit(aggregate_emit);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    // Map Phase: every map task folds its records into a table
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    if (files) {
+        Input_prepare(pool, file_count, file_names, files, submit_map_job, pool);
+        Core_wait(pool);
+        Input_release(files, file_count);
+        free(files);
+    }
+    Core_set_emit(NULL);
+
+    // Reduce Phase: a tree of merges, then the results
+    KVTable *result = merge_tree(pool);
+    if (result) write_results(result, num_parts);
+
+    ThreadPool_destroy(pool);
+    for (size_t i = 0; i < partial_count; i++) {
+        partial_free(&partials[i]);
+    }
+    free(partials);
+    partials = NULL;
+    partial_count = 0;
+    partial_cap = 0;
+    Core_finish();
+}
+
+// Emit function: fold the record into the shared counters
+static void counter_emit(char *key, char *value, unsigned int partition_idx) {
+    // a key past the map's capacity: the results would be incomplete
+    if (!Counter_add(counters, key, strtoll(value, NULL, 10))) MR_Cancel();
+}
+
+static void collect_counter(const char *key, long long value, void *ctx) {
+    char text[32];
+    snprintf(text, sizeof(text), "%lld", value);
+    if (!Table_add((KVTable *)ctx, key, text, Aggregate_sum)) MR_Cancel();
+}
+
+// Main shared counter execution function
+void MR_RunCounters(unsigned int file_count, char *file_names[], Mapper mapper, CounterOp op,
+                    size_t max_keys, unsigned int num_workers, unsigned int num_parts) {
+    counters = Counter_create(max_keys, op);
+    if (!counters) return;
+    Core_init(mapper, 1);
+    Core_set_emit(counter_emit);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    // Map Phase: every map task updates the one map
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    if (files) {
+        Input_prepare(pool, file_count, file_names, files, submit_map_job, pool);
+        Core_wait(pool);
+        Input_release(files, file_count);
+        free(files);
+    }
+    ThreadPool_destroy(pool);
+    Core_set_emit(NULL);
+
+    // the keys are few, so the results go through a table to be written
+    KVTable *result = !MR_Cancelled() ? Table_create(Counter_count(counters)) : NULL;
+    if (result) {
+        Counter_foreach(counters, collect_counter, result);
+        if (!MR_Cancelled()) write_results(result, num_parts);
+        Table_free(result);
+    }
+    Counter_free(counters);
+    counters = NULL;
+    Core_finish();
+}
+
+// Combine functions for integer values
+char *Aggregate_sum(const char *key, const char *a, const char *b) {
+    char *sum = NULL;
+    if (asprintf(&sum, "%lld", strtoll(a, NULL, 10) + strtoll(b, NULL, 10)) < 0) return NULL;
+    return sum;
+}
+
+char *Aggregate_min(const char *key, const char *a, const char *b) {
+    return strdup(strtoll(b, NULL, 10) < strtoll(a, NULL, 10) ? b : a);
+}
+
+char *Aggregate_max(const char *key, const char *a, const char *b) {
+    return strdup(strtoll(b, NULL, 10) > strtoll(a, NULL, 10) ? b : a);
+}
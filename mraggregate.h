@@ -0,0 +1,60 @@
+// Tree aggregation for associative and commutative reducers: each map task
+// folds its own records into a table, and the tables are merged pairwise
+// in parallel, in log2(map tasks) levels, instead of funnelling every
+// record of a key into one reducer. Integer aggregates over few keys can
+// instead update one map shared by all map tasks.
+#ifndef MRAGGREGATE_H
+#define MRAGGREGATE_H
+#include "mapreduce.h"
+#include "mrcounter.h"
+#include "mrtable.h"
+
+/**
+* Run an aggregation. The mapper emits with MR_Emit as in MR_Run, and the
+* values of each key are folded with combine, in any order and grouping,
+* so combine must be associative and commutative. Results are written as
+* MR_Run writes them: "key: value" lines of result-<partition>.txt, in key
+* order within each partition. To size its table, each map task of the
+* first wave (before any has finished) first runs the mapper over the
+* first 256 KiB of its input, with what it emits discarded, so anything
+* the mapper does besides MR_Emit happens twice for those lines.
+* Parameters:
+*     file_count  - Number of files (i.e. input splits)
+*     file_names  - Array of filenames
+*     mapper      - Function pointer to the map function
+*     combine     - Folds two values of a key
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of result partitions
+* Note: meant for aggregates with few keys (totals, global statistics);
+*       with many keys, shuffle them with MR_Run instead
+*/
+void MR_RunAggregate(unsigned int file_count, char *file_names[], Mapper mapper,
+                     TableCombine combine, unsigned int num_workers, unsigned int num_parts);
+
+/**
+* Run an aggregation of integer values through one map shared by all map
+* tasks (mrcounter.h), updated in place with atomic instructions: there is
+* no table per task to merge and no lock, so it suits few keys updated
+* often (e.g. per-category totals of a skewed stream). Results are written
+* as MR_RunAggregate writes them.
+* Parameters:
+*     file_count  - Number of files (i.e. input splits)
+*     file_names  - Array of filenames
+*     mapper      - Function pointer to the map function; values emitted
+*                   are read as integers
+*     op          - How the values of a key are folded
+*     max_keys    - Most distinct keys the job may emit; one more cancels it
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of result partitions
+*/
+void MR_RunCounters(unsigned int file_count, char *file_names[], Mapper mapper, CounterOp op,
+                    size_t max_keys, unsigned int num_workers, unsigned int num_parts);
+
+/**
+* Combine functions for integer values: their sum, least and greatest
+*/
+char *Aggregate_sum(const char *key, const char *a, const char *b);
+char *Aggregate_min(const char *key, const char *a, const char *b);
+char *Aggregate_max(const char *key, const char *a, const char *b);
+
+#endif
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include "mrbroadcast.h"
+#include "mrinput.h"
+#include "mrtable.h"
+#include "threadpool.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BROADCAST_MAGIC "MRBCAST2"
+#define MIN_SLOTS 16
+
+// Start of a table's image: the header, then the slots, then the records
+// as key, NUL, value, NUL
+typedef struct {
+    char magic[8];
+    uint64_t size;        // bytes in the image
+    uint32_t slot_count;  // power of two, at least twice the keys
+    uint32_t count;       // keys
+} ImageHeader;
+
+// Open-addressing slot; the hash is kept beside the offset so a probe
+// only touches a record when the hashes match
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;  // of the record in the image, 0 if empty
+} Slot;
+
+struct Broadcast {
+    unsigned char *map;
+    size_t size;
+    const Slot *slots;
+    uint32_t mask;
+};
+
+// Records read while loading, in load order
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t records;
+    bool failed;
+    pthread_mutex_t lock;
+} Loader;
+
+// Hash of a key, as the other hash tables use, cut to the 32 bits a slot
+// keeps
+static uint32_t hash_key(const char *key) {
+    return (uint32_t)Table_hash(key);
+}
+
+static void add_record(Loader *loader, const char *line, size_t len) {
+    size_t key_len = strcspn(line, " \t");
+    if (key_len == 0) return;
+    const char *value = key_len < len ? line + key_len + 1 : "";
+    size_t value_len = key_len < len ? len - key_len - 1 : 0;
+
+    size_t need = loader->len + key_len + value_len + 2;
+    if (need > loader->cap) {
+        size_t cap = loader->cap ? loader->cap : 4096;
+        while (cap < need) cap *= 2;
+        char *grown = realloc(loader->data, cap);
+        if (!grown) {
+            loader->failed = true;
+            return;
+        }
+        loader->data = grown;
+        loader->cap = cap;
+    }
+    memcpy(loader->data + loader->len, line, key_len);
+    loader->data[loader->len + key_len] = '\0';
+    memcpy(loader->data + loader->len + key_len + 1, value, value_len);
+    loader->data[need - 1] = '\0';
+    loader->len = need;
+    loader->records++;
+}
+
+static void load_file(Loader *loader, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        loader->failed = true;
+        return;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, fp)) != -1 && !loader->failed) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        add_record(loader, line, len);
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Pipe blocks are read as they arrive, as they are released one by one;
+// files wait so they are loaded in the order they were given
+static void input_ready(InputFile *file, void *ctx) {
+    if (!file->block) return;
+    Loader *loader = (Loader *)ctx;
+    pthread_mutex_lock(&loader->lock);
+    load_file(loader, file->path);
+    pthread_mutex_unlock(&loader->lock);
+    Input_done(file);
+}
+
+// Wrap an image, checking that it is whole and consistent
+static Broadcast *wrap_image(unsigned char *map, size_t size) {
+    const ImageHeader *header = (const ImageHeader *)map;
+    if (size < sizeof(ImageHeader) || memcmp(header->magic, BROADCAST_MAGIC, 8) != 0 ||
+        header->size != size || header->slot_count == 0 ||
+        (header->slot_count & (header->slot_count - 1)) != 0 ||
+        sizeof(ImageHeader) + (uint64_t)header->slot_count * sizeof(Slot) > size) {
+        return NULL;
+    }
+
+    // every slot in use must point at a record in the record area whose key
+    // and value end inside the image, and a free slot must stop each probe
+    size_t records_at = sizeof(ImageHeader) + (size_t)header->slot_count * sizeof(Slot);
+    if (size > records_at && map[size - 1] != '\0') return NULL;
+    const Slot *slots = (const Slot *)(map + sizeof(ImageHeader));
+    uint32_t used = 0;
+    for (uint32_t s = 0; s < header->slot_count; s++) {
+        uint32_t offset = slots[s].offset;
+        if (!offset) continue;
+        if (offset < records_at || offset >= size) return NULL;
+        const unsigned char *key_end = memchr(map + offset, '\0', size - offset);
+        if (key_end + 1 >= map + size) return NULL;
+        used++;
+    }
+    if (used != header->count || used == header->slot_count) return NULL;
+
+    Broadcast *table = malloc(sizeof(Broadcast));
+    if (!table) return NULL;
+    table->map = map;
+    table->size = size;
+    table->slots = slots;
+    table->mask = header->slot_count - 1;
+    return table;
+}
+
+// Lay the loaded records out as an image in a read-only shared mapping
+static Broadcast *build_image(Loader *loader) {
+    uint32_t slot_count = MIN_SLOTS;
+    while (slot_count < 2 * loader->records) {
+        if (slot_count > UINT32_MAX / 2) return NULL;
+        slot_count *= 2;
+    }
+    size_t records_at = sizeof(ImageHeader) + (size_t)slot_count * sizeof(Slot);
+    size_t size = records_at + loader->len;
+    if (size > UINT32_MAX) return NULL;
+
+    int fd = memfd_create("mr-broadcast", MFD_CLOEXEC);
+    if (fd < 0) return NULL;
+    unsigned char *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    ImageHeader *header = (ImageHeader *)map;
+    memcpy(header->magic, BROADCAST_MAGIC, 8);
+    header->size = size;
+    header->slot_count = slot_count;
+    header->count = 0;
+    Slot *slots = (Slot *)(map + sizeof(ImageHeader));
+    memcpy(map + records_at, loader->data, loader->len);
+
+    uint32_t mask = slot_count - 1;
+    size_t pos = 0;
+    while (pos < loader->len) {
+        const char *key = loader->data + pos;
+        size_t key_len = strlen(key);
+        uint32_t hash = hash_key(key);
+        uint32_t s = hash & mask;
+        while (slots[s].offset && (slots[s].hash != hash ||
+                                   strcmp((char *)map + slots[s].offset, key) != 0)) {
+            s = (s + 1) & mask;
+        }
+        if (!slots[s].offset) {
+            slots[s].hash = hash;
+            slots[s].offset = (uint32_t)(records_at + pos);
+            header->count++;
+        }
+        pos += key_len + 1;
+        pos += strlen(loader->data + pos) + 1;
+    }
+
+    mprotect(map, size, PROT_READ);
+    Broadcast *table = wrap_image(map, size);
+    if (!table) munmap(map, size);
+    return table;
+}
+
+// Load text files into a broadcast table
+Broadcast *Broadcast_load(unsigned int file_count, char *file_names[]) {
+    Loader loader = { 0 };
+    pthread_mutex_init(&loader.lock, NULL);
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    ThreadPool_t *pool = ThreadPool_create(1);
+    Broadcast *table = NULL;
+    if (files && pool) {
+        Input_prepare_all(pool, file_count, file_names, files, input_ready, &loader);
+        ThreadPool_check(pool);
+        for (unsigned int i = 0; i < file_count && !loader.failed; i++) {
+            if (files[i].format != INPUT_PIPE) load_file(&loader, files[i].path);
+        }
+        Input_release(files, file_count);
+        if (!loader.failed) table = build_image(&loader);
+    }
+    if (pool) ThreadPool_destroy(pool);
+    free(files);
+    free(loader.data);
+    pthread_mutex_destroy(&loader.lock);
+    return table;
+}
+
+// Write a table to a file
+bool Broadcast_save(const Broadcast *table, const char *path) {
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.tmp", path) < 0) return false;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    for (size_t done = 0; ok && done < table->size;) {
+        ssize_t n = write(fd, table->map + done, table->size - done);
+        if (n <= 0) ok = false;
+        else done += n;
+    }
+    if (fd >= 0) {
+        if (ok && fsync(fd) != 0) ok = false;
+        close(fd);
+    }
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) unlink(tmp);
+    free(tmp);
+    return ok;
+}
+
+// Map a table written by Broadcast_save
+Broadcast *Broadcast_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    unsigned char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ImageHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    Broadcast *table = wrap_image(map, st.st_size);
+    if (!table) munmap(map, st.st_size);
+    return table;
+}
+
+// Look a key up
+const char *Broadcast_get(const Broadcast *table, const char *key) {
+    uint32_t hash = hash_key(key);
+    for (uint32_t s = hash & table->mask;; s = (s + 1) & table->mask) {
+        const Slot *slot = &table->slots[s];
+        if (!slot->offset) return NULL;
+        if (slot->hash != hash) continue;
+        const char *record = (const char *)table->map + slot->offset;
+        if (strcmp(record, key) == 0) return record + strlen(record) + 1;
+    }
+}
+
+// Get the number of keys in a table
+size_t Broadcast_count(const Broadcast *table) {
+    return ((const ImageHeader *)table->map)->count;
+}
+
+// Unmap a table
+void Broadcast_free(Broadcast *table) {
+    if (!table) return;
+    munmap(table->map, table->size);
+    free(table);
+}
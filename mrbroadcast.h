@@ -0,0 +1,71 @@
+// Broadcast tables: a small table loaded once into a read-only hash table
+// that every map task looks records up in, so joining a large input with it
+// needs no shuffle of the large side.
+#ifndef MRBROADCAST_H
+#define MRBROADCAST_H
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Broadcast Broadcast;
+
+/**
+* Load text files into a broadcast table, one record per line: the key is
+* the line up to its first space or tab and the value the rest of it.
+* Compressed files are read as MR_Run reads them. The table is a single
+* read-only mapping of an anonymous memory file, so worker processes forked
+* after it is loaded (cluster mode) share its pages instead of copying them.
+* Parameters:
+*     file_count - Number of files
+*     file_names - Array of file names
+* Return:
+*     Broadcast* - Table, or NULL if a file cannot be read, memory runs out
+*                  or the table outgrows 4 GB
+* Note: a key loaded more than once keeps its first value
+*/
+Broadcast *Broadcast_load(unsigned int file_count, char *file_names[]);
+
+/**
+* Write a table to a file that Broadcast_open maps, so processes that do
+* not share a parent can share the table through the page cache
+* Parameters:
+*     table - Table to write
+*     path  - Where to write it; replaced only once fully written
+* Return:
+*     true  - On success
+*     false - Otherwise
+*/
+bool Broadcast_save(const Broadcast *table, const char *path);
+
+/**
+* Map a table written by Broadcast_save, read-only
+* Parameters:
+*     path - File written by Broadcast_save
+* Return:
+*     Broadcast* - Table, or NULL if the file is missing, not a table or
+*                  damaged (a slot pointing outside the records, a record
+*                  not ending in the image)
+*/
+Broadcast *Broadcast_open(const char *path);
+
+/**
+* Look a key up; safe to call from any number of threads at once
+* Parameters:
+*     table - Table to search
+*     key   - Key to find
+* Return:
+*     const char * - Value of the key, valid until the table is freed
+*     NULL         - If the table has no such key
+*/
+const char *Broadcast_get(const Broadcast *table, const char *key);
+
+/**
+* Get the number of keys in a table
+*/
+size_t Broadcast_count(const Broadcast *table);
+
+/**
+* Unmap a table
+*/
+void Broadcast_free(Broadcast *table);
+
+#endif
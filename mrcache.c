@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "mrcache.h"
+#include "mrtable.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Hash of the contents of a file, a word at a time
+static uint64_t hash_file(const char *name, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ size;
+    if (size == 0) return hash;
+
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return 0;
+    const unsigned char *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+    madvise((void *)p, size, MADV_SEQUENTIAL);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+
+    munmap((void *)p, size);
+    return hash;
+}
+
+// Search for the build-id of the module holding an address
+typedef struct {
+    uintptr_t addr;
+    char id[2 * 64 + 1];  // hex digits, or empty if not found
+} BuildIdSearch;
+
+// Look for the GNU build-id note of a module if it holds the address
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *ctx) {
+    BuildIdSearch *search = (BuildIdSearch *)ctx;
+    bool holds = false;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+        if (ph->p_type == PT_LOAD && search->addr >= start && search->addr - start < ph->p_memsz) {
+            holds = true;
+        }
+    }
+    if (!holds) return 0;
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE) continue;
+        const unsigned char *p = (const unsigned char *)(info->dlpi_addr + ph->p_vaddr);
+        const unsigned char *end = p + ph->p_memsz;
+        while ((size_t)(end - p) >= sizeof(ElfW(Nhdr))) {
+            const ElfW(Nhdr) *note = (const ElfW(Nhdr) *)p;
+            size_t name_len = (note->n_namesz + 3) & ~(size_t)3;
+            size_t desc_len = (note->n_descsz + 3) & ~(size_t)3;
+            const unsigned char *desc = p + sizeof(ElfW(Nhdr)) + name_len;
+            if (name_len > (size_t)(end - p) || desc_len > (size_t)(end - desc)) break;
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(p + sizeof(ElfW(Nhdr)), "GNU", 4) == 0 && note->n_descsz <= 64) {
+                for (size_t k = 0; k < note->n_descsz; k++) {
+                    snprintf(search->id + 2 * k, 3, "%02x", desc[k]);
+                }
+                return 1;
+            }
+            p = desc + desc_len;
+        }
+    }
+    return 1;
+}
+
+// Describe a job by where its map function is (the module and the offset
+// in it), the build of that module (its build-id, or else the size and
+// mtime of its file) and the name it was given
+char *Cache_job(const void *mapper, const char *name) {
+    Dl_info info;
+    const char *module = "?";
+    unsigned long long offset = (unsigned long long)(uintptr_t)mapper;
+    if (dladdr(mapper, &info) && info.dli_fname) {
+        module = info.dli_fname;
+        offset -= (uintptr_t)info.dli_fbase;
+    }
+
+    BuildIdSearch search = { (uintptr_t)mapper, "" };
+    dl_iterate_phdr(find_build_id, &search);
+    char build[64] = "?";
+    struct stat st;
+    if (search.id[0] == '\0' && stat(*module ? module : "/proc/self/exe", &st) == 0) {
+        snprintf(build, sizeof(build), "%lld@%lld.%09ld", (long long)st.st_size,
+                 (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    }
+
+    char *job = NULL;
+    if (asprintf(&job, "%s+%llx %s %s", module, offset, search.id[0] ? search.id : build,
+                 name ? name : "") < 0) {
+        return NULL;
+    }
+    return job;
+}
+
+// Look up the cached output of an input
+bool Cache_lookup(const char *dir, const char *name, bool hash_contents, const char *job,
+                  CacheEntry *entry) {
+    entry->path[0] = '\0';
+    entry->identity = NULL;
+    memset(&entry->reader, 0, sizeof(entry->reader));
+
+    // only regular files have a stable identity
+    struct stat st;
+    char *real = realpath(name, NULL);
+    if (!real || stat(real, &st) != 0 || !S_ISREG(st.st_mode)) {
+        free(real);
+        return false;
+    }
+
+    unsigned long long hash = hash_contents ? hash_file(real, (size_t)st.st_size) : 0;
+    if (asprintf(&entry->identity, "%lld %lld.%09ld %016llx %s\n%s", (long long)st.st_size,
+                 (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, hash, real, job) < 0) {
+        entry->identity = NULL;
+        free(real);
+        return false;
+    }
+    // jobs sharing the directory keep their outputs of an input apart
+    snprintf(entry->path, sizeof(entry->path), "%s/%016llx-%016llx.run", dir,
+             (unsigned long long)Table_hash(real), (unsigned long long)Table_hash(job));
+    free(real);
+
+    // keep the file mapped so it cannot vanish before it is loaded
+    if (!Run_open(&entry->reader, entry->path)) return false;
+    if (strcmp(entry->reader.header, entry->identity) != 0) {
+        Run_close(&entry->reader);
+        return false;
+    }
+    return true;
+}
+
+// Start caching the output of an input
+RunWriter *Cache_writer(const CacheEntry *entry) {
+    if (entry->path[0] == '\0') return NULL;
+    return Run_create(entry->path, entry->identity);
+}
+
+// Free an entry
+void Cache_release(CacheEntry *entry) {
+    Run_close(&entry->reader);
+    free(entry->identity);
+    entry->identity = NULL;
+}
@@ -0,0 +1,63 @@
+// Cache of per-input map output for incremental re-runs. An input's
+// cached output is reused by the same job while its path, size and mtime
+// (and, optionally, a hash of its contents) are unchanged.
+#ifndef MRCACHE_H
+#define MRCACHE_H
+#include <limits.h>
+#include <stdbool.h>
+#include "runfile.h"
+
+typedef struct {
+    char path[PATH_MAX];  // cache file for the input ('\0' if not cacheable)
+    char *identity;       // header that a valid cache file must carry
+    RunReader reader;     // open on the cache file after a hit
+} CacheEntry;
+
+/**
+* Describe a job for Cache_lookup
+* Parameters:
+*     mapper - Map function of the job; a rebuilt program or another map
+*              function makes another job
+*     name   - Identity the caller gives the job (e.g. its name and the
+*              settings its map output depends on), or NULL
+* Return:
+*     char * - Description, freed with free, or NULL if out of memory
+*/
+char *Cache_job(const void *mapper, const char *name);
+
+/**
+* Look up the cached map output of an input
+* Parameters:
+*     dir           - Cache directory
+*     name          - Input file name
+*     hash_contents - Whether the contents must also be unchanged
+*     job           - Job mapping the input, described by Cache_job; only
+*                     its own output is reused
+*     entry         - Filled in with the cache file and identity of the input
+* Return:
+*     true  - If entry->path holds output that is valid for the input;
+*             entry->reader is open on it
+*     false - Otherwise; the input must be mapped (and can then be cached
+*             with Cache_writer unless entry->path is empty)
+*/
+bool Cache_lookup(const char *dir, const char *name, bool hash_contents, const char *job,
+                  CacheEntry *entry);
+
+/**
+* Start writing the map output of an input to the cache
+* Parameters:
+*     entry - Entry filled in by Cache_lookup
+* Return:
+*     RunWriter* - Writer to commit with Run_commit once the map task
+*                  succeeds, or NULL if the input cannot be cached
+*/
+RunWriter *Cache_writer(const CacheEntry *entry);
+
+/**
+* Release the memory held by an entry (closing its reader)
+* Parameters:
+*     entry - Entry filled in by Cache_lookup
+*/
+void Cache_release(CacheEntry *entry);
+
+#endif
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "mrcheckpoint.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Describes the job the checkpoints in a directory belong to
+#define JOB_FILE "job"
+
+// Make the entries of a directory durable
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+// Write a small file durably, replacing any previous version
+static bool write_durable(const char *dir, const char *name, const char *data, size_t len) {
+    char path[4096], tmp[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    snprintf(tmp, sizeof(tmp), "%s/%s.tmp", dir, name);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return false;
+    bool ok = write(fd, data, len) == (ssize_t)len && fsync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    sync_dir(dir);
+    return ok;
+}
+
+// Describe a job by its partition count and inputs
+static char *job_description(unsigned int num_parts, unsigned int file_count, char *file_names[]) {
+    size_t len = 32;
+    for (unsigned int i = 0; i < file_count; i++) {
+        len += strlen(file_names[i]) + 1;
+    }
+    char *desc = malloc(len);
+    if (!desc) return NULL;
+
+    size_t pos = (size_t)snprintf(desc, len, "parts %u\n", num_parts);
+    for (unsigned int i = 0; i < file_count; i++) {
+        pos += (size_t)snprintf(desc + pos, len - pos, "%s\n", file_names[i]);
+    }
+    return desc;
+}
+
+// Whether a directory entry is a checkpoint file
+static bool is_checkpoint_file(const char *name) {
+    size_t len = strlen(name);
+    return strcmp(name, JOB_FILE) == 0 ||
+           (strncmp(name, "reduce-", 7) == 0 && strstr(name, ".done") != NULL) ||
+           (len > 4 && strcmp(name + len - 4, ".run") == 0) ||
+           strstr(name, ".run.tmp.") != NULL ||
+           strcmp(name, JOB_FILE ".tmp") == 0;
+}
+
+static void remove_checkpoints(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (!is_checkpoint_file(ent->d_name)) continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+// Open the checkpoint directory of a job
+bool Checkpoint_open(const char *dir, bool resume, unsigned int num_parts,
+                     unsigned int file_count, char *file_names[]) {
+    mkdir(dir, 0777);
+    char *desc = job_description(num_parts, file_count, file_names);
+    if (!desc) return false;
+
+    bool resumed = false;
+    if (resume) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, JOB_FILE);
+        FILE *fp = fopen(path, "r");
+        if (fp) {
+            size_t len = strlen(desc);
+            char *old = malloc(len + 2);
+            size_t got = old ? fread(old, 1, len + 1, fp) : 0;
+            resumed = got == len && memcmp(old, desc, len) == 0;
+            free(old);
+            fclose(fp);
+            if (!resumed) {
+                fprintf(stderr, "mapreduce: %s: checkpoints belong to a different job, starting over\n", dir);
+            }
+        }
+    }
+
+    if (!resumed) {
+        remove_checkpoints(dir);
+        write_durable(dir, JOB_FILE, desc, strlen(desc));
+    }
+    free(desc);
+    return resumed;
+}
+
+// Check for the marker of a finished partition
+bool Checkpoint_partition_done(const char *dir, unsigned int partition_idx) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/reduce-%u.done", dir, partition_idx);
+    return access(path, F_OK) == 0;
+}
+
+// Write the marker of a finished partition
+void Checkpoint_mark_partition(const char *dir, unsigned int partition_idx) {
+    char name[32];
+    snprintf(name, sizeof(name), "reduce-%u.done", partition_idx);
+    write_durable(dir, name, "", 0);
+}
+
+// Remove the checkpoints of a completed job
+void Checkpoint_clear(const char *dir) {
+    remove_checkpoints(dir);
+    rmdir(dir);
+}
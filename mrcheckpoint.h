@@ -0,0 +1,49 @@
+// Durable checkpoints of a running job: the output of finished map tasks
+// (stored like the incremental cache, see mrcache.h) and markers for
+// finished reduce partitions, so a restarted job can skip both.
+#ifndef MRCHECKPOINT_H
+#define MRCHECKPOINT_H
+#include <stdbool.h>
+
+/**
+* Open the checkpoint directory of a job
+* Parameters:
+*     dir        - Checkpoint directory (created if missing)
+*     resume     - Whether to keep checkpoints left by an earlier attempt
+*     num_parts  - Number of partitions of the job
+*     file_count - Number of input files
+*     file_names - Input file names
+* Return:
+*     true  - If checkpoints of an earlier attempt of the same job are kept
+*     false - If the directory now holds no checkpoints
+* Note: checkpoints written for different inputs or partition counts are
+*       discarded even when resuming
+*/
+bool Checkpoint_open(const char *dir, bool resume, unsigned int num_parts,
+                     unsigned int file_count, char *file_names[]);
+
+/**
+* Check whether a reduce partition finished in an earlier attempt
+* Parameters:
+*     dir           - Checkpoint directory
+*     partition_idx - Index of the partition
+*/
+bool Checkpoint_partition_done(const char *dir, unsigned int partition_idx);
+
+/**
+* Durably record that a reduce partition has finished
+* Parameters:
+*     dir           - Checkpoint directory
+*     partition_idx - Index of the partition
+*/
+void Checkpoint_mark_partition(const char *dir, unsigned int partition_idx);
+
+/**
+* Remove the checkpoints of a job that has completed, and the directory
+* if nothing else is left in it
+* Parameters:
+*     dir - Checkpoint directory
+*/
+void Checkpoint_clear(const char *dir);
+
+#endif
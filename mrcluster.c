@@ -0,0 +1,813 @@
+#define _GNU_SOURCE
+#include "mrcluster.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "mrshuffle.h"
+#include "runfile.h"
+#include "threadpool.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Attempts of a task before the job fails
+#define CLUSTER_MAX_ATTEMPTS 3
+#define CLUSTER_POLL_MS 100
+// Shuffle segments passed in one message (below the kernel's SCM_MAX_FD)
+#define SEG_BATCH 128
+
+// Message types exchanged with the workers
+typedef enum {
+    MSG_MAP,       // coordinator: run a map task
+    MSG_REDUCE,    // coordinator: run a reduce task
+    MSG_SEGMENTS,  // either way: shuffle segments attached as descriptors
+    MSG_LOCATIONS, // coordinator: servers holding the map output to fetch
+    MSG_DONE,      // worker: the task succeeded
+    MSG_FAILED     // worker: the task failed
+} MsgType;
+
+// Message sent over a worker's socket, in either direction
+typedef struct {
+    MsgType type;
+    unsigned int task;              // map task index or partition
+    unsigned int attempt;           // 1 for the first attempt of the task
+    unsigned int count;             // segments attached (MSG_SEGMENTS) or
+                                    // locations (MSG_LOCATIONS)
+    unsigned int parts[SEG_BATCH];  // partition of each attached segment, or
+                                    // map task of each location
+    unsigned short ports[SEG_BATCH];// server port of each location
+    unsigned short port;            // server of a map task's output (MSG_DONE)
+} ClusterMsg;
+
+// A worker process as seen by the coordinator
+typedef struct {
+    pid_t pid;
+    int sock;  // coordinator end of the worker's socket (-1: no worker)
+    int task;  // task being run, or -1 when idle
+    long long deadline_ms;  // when the task times out (0: never, or killed)
+} Worker;
+
+typedef enum { TASK_PENDING, TASK_RUNNING, TASK_DONE } TaskState;
+
+typedef struct {
+    TaskState state;
+    unsigned int attempts;
+} Task;
+
+// How a phase ended; PHASE_LOST means map output the reduce phase needs
+// was lost with its worker
+typedef enum { PHASE_DONE, PHASE_FAILED, PHASE_LOST } PhaseResult;
+
+static ClusterShuffle shuffle_kind = CLUSTER_SHUFFLE_SHM;
+static bool fetch_compress = false;
+static size_t fetch_in_flight = SHUFFLE_DEFAULT_IN_FLIGHT;
+
+// Job description, set up before the workers are forked
+static char shuffle_dir[PATH_MAX];
+static InputFile **inputs = NULL;  // by map task
+static unsigned int map_count = 0;
+static unsigned int part_count = 0;
+static Mapper cluster_mapper = NULL;
+static Reducer cluster_reducer = NULL;
+static pthread_mutex_t inputs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Coordinator state of the shared-memory shuffle: the segment of each map
+// task and partition (-1 where the task emitted nothing)
+static int *shuffle_fds = NULL;
+
+// Coordinator state of the socket shuffle: the port serving the output of
+// each map task and the worker process behind it
+static unsigned short *map_ports = NULL;
+static pid_t *map_owners = NULL;
+static Task *map_tasks = NULL;
+
+// Worker state: the runs of the map task being run (and their segments),
+// the segments sent for the next reduce task, the runs whose records the
+// partition being reduced points into and the result file of the reduce
+// task being run
+static RunWriter **writers = NULL;
+static int *segments = NULL;
+static unsigned int current_task = 0;
+static bool emit_failed = false;
+static int *reduce_segs = NULL;
+static unsigned int reduce_seg_count = 0;
+static ShuffleServer *server = NULL;
+static ShuffleSource *reduce_sources = NULL;
+static unsigned int reduce_source_count = 0;
+static RunReader *reduce_runs = NULL;
+static unsigned int reduce_run_count = 0;
+static bool load_failed = false;
+static FILE *result_file = NULL;
+static unsigned int result_attempt = 0;
+
+// Choose how map output reaches the reduce tasks
+void MR_SetClusterShuffle(ClusterShuffle shuffle) {
+    shuffle_kind = shuffle;
+}
+
+// Tune the fetches of the socket shuffle
+void MR_SetClusterFetch(bool compress, size_t max_in_flight) {
+    fetch_compress = compress;
+    fetch_in_flight = max_in_flight ? max_in_flight : SHUFFLE_DEFAULT_IN_FLIGHT;
+}
+
+// Send a message with descriptors attached
+static bool send_msg(int sock, const ClusterMsg *msg, const int *fds, unsigned int nfds) {
+    struct iovec iov = { (void *)msg, sizeof(*msg) };
+    struct msghdr mh = { 0 };
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    union {
+        char buf[CMSG_SPACE(SEG_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    if (nfds > 0) {
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == sizeof(*msg);
+}
+
+// Receive a message; for MSG_SEGMENTS, count is set to the number of
+// descriptors actually received into fds
+static bool recv_msg(int sock, ClusterMsg *msg, int *fds) {
+    struct iovec iov = { msg, sizeof(*msg) };
+    struct msghdr mh = { 0 };
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    union {
+        char buf[CMSG_SPACE(SEG_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t got = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    unsigned int nfds = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); got > 0 && cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        unsigned int n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (n > SEG_BATCH - nfds) n = SEG_BATCH - nfds;
+        memcpy(fds + nfds, CMSG_DATA(cm), n * sizeof(int));
+        nfds += n;
+    }
+
+    if (got != sizeof(*msg) || msg->type != MSG_SEGMENTS) {
+        for (unsigned int i = 0; i < nfds; i++) close(fds[i]);
+        return got == sizeof(*msg);
+    }
+    if (msg->count > nfds) msg->count = nfds;
+    for (unsigned int i = msg->count; i < nfds; i++) close(fds[i]);
+    return true;
+}
+
+// Send segments in batches of SEG_BATCH, each with its partition
+static bool send_segments(int sock, unsigned int task, const int *fds, const unsigned int *parts,
+                          unsigned int count) {
+    for (unsigned int i = 0; i < count; i += SEG_BATCH) {
+        ClusterMsg msg = { MSG_SEGMENTS, task, 0, count - i < SEG_BATCH ? count - i : SEG_BATCH };
+        memcpy(msg.parts, parts + i, msg.count * sizeof(unsigned int));
+        if (!send_msg(sock, &msg, fds + i, msg.count)) return false;
+    }
+    return true;
+}
+
+// Path of the run holding the output of a map task for a partition
+static void shuffle_path(char *buf, size_t len, unsigned int map, unsigned int part) {
+    snprintf(buf, len, "%s/map-%u-%u.run", shuffle_dir, map, part);
+}
+
+// Start the run of a partition for the map task being run
+static RunWriter *open_run(unsigned int idx) {
+    if (shuffle_kind == CLUSTER_SHUFFLE_FILES) {
+        char path[PATH_MAX];
+        shuffle_path(path, sizeof(path), current_task, idx);
+        return Run_create(path, "map");
+    }
+    segments[idx] = memfd_create("mr-shuffle", MFD_CLOEXEC);
+    if (segments[idx] < 0) return NULL;
+    return Run_create_fd(segments[idx], "map");
+}
+
+// Record a map output record in the run of its partition
+static void cluster_emit(char *key, char *value, unsigned int idx) {
+    if (!writers[idx]) {
+        writers[idx] = open_run(idx);
+        if (!writers[idx]) {
+            emit_failed = true;
+            return;
+        }
+    }
+    if (!Run_append(writers[idx], key, value)) emit_failed = true;
+}
+
+// Map one input into a run per partition; with the shared-memory shuffle
+// the segments holding the runs are sent to the coordinator, with the
+// socket shuffle they are handed to this worker's server
+static bool run_map_task(int sock, unsigned int task) {
+    current_task = task;
+    emit_failed = false;
+
+    Core_set_emit(cluster_emit);
+    cluster_mapper(inputs[task]->path);
+    Core_set_emit(NULL);
+
+    // the runs only appear once every one of them is complete
+    bool ok = !emit_failed;
+    for (unsigned int p = 0; p < part_count; p++) {
+        if (!writers[p]) continue;
+        if (ok) {
+            ok = Run_commit(writers[p]);
+        } else {
+            Run_abort(writers[p]);
+        }
+        writers[p] = NULL;
+    }
+    if (shuffle_kind == CLUSTER_SHUFFLE_FILES) return ok;
+
+    int *fds = malloc(part_count * sizeof(int));
+    unsigned int *parts = malloc(part_count * sizeof(unsigned int));
+    unsigned int count = 0;
+    for (unsigned int p = 0; fds && parts && p < part_count; p++) {
+        if (segments[p] < 0) continue;
+        fds[count] = segments[p];
+        parts[count++] = p;
+    }
+    ok = ok && fds && parts;
+    if (ok && shuffle_kind == CLUSTER_SHUFFLE_SOCKET) {
+        // the server takes the segments over
+        ok = Shuffle_publish(server, task, fds, parts, count);
+        for (unsigned int p = 0; p < part_count; p++) segments[p] = -1;
+    } else if (ok) {
+        ok = send_segments(sock, task, fds, parts, count);
+    }
+    for (unsigned int p = 0; p < part_count; p++) {
+        if (segments[p] >= 0) close(segments[p]);
+        segments[p] = -1;
+    }
+    free(fds);
+    free(parts);
+    return ok;
+}
+
+// Write a reduce result to the result file of the partition
+static void cluster_output(char *key, char *value, unsigned int partition_idx) {
+    if (!result_file) {
+        char name[32];
+        snprintf(name, sizeof(name), "result-%u.txt", partition_idx);
+        // a retried task replaces the partial results of the failed one
+        result_file = fopen(name, result_attempt > 1 ? "w" : "a");
+        if (!result_file) return;
+    }
+    fprintf(result_file, "%s: %s\n", key, value);
+}
+
+// Load a run into the partition being reduced. Its records are read in
+// place, so the run stays mapped until the partition is reduced.
+static void load_run(RunReader *reader, unsigned int part) {
+    char *key, *value;
+    // a reduce task has a run per map task at most
+    if (reduce_run_count == map_count) {
+        Run_close(reader);
+        load_failed = true;
+        return;
+    }
+    reduce_runs[reduce_run_count++] = *reader;
+    while (!load_failed && Run_next(reader, &key, &value)) {
+        if (!Core_add_mapped(part, key, value)) load_failed = true;
+    }
+}
+
+// Load a run fetched from a server
+static void load_fetched(int fd, void *ctx) {
+    RunReader reader;
+    if (Run_open_fd(&reader, fd)) load_run(&reader, *(unsigned int *)ctx);
+}
+
+// Unmap the runs of the partition once it no longer points into them
+static void close_runs(void) {
+    for (unsigned int i = 0; i < reduce_run_count; i++) Run_close(&reduce_runs[i]);
+    reduce_run_count = 0;
+}
+
+// Load the map output of a partition and reduce it
+static bool run_reduce_task(unsigned int part, unsigned int attempt) {
+    RunReader reader;
+    load_failed = false;
+    if (shuffle_kind == CLUSTER_SHUFFLE_FILES) {
+        char path[PATH_MAX];
+        for (unsigned int i = 0; i < map_count; i++) {
+            shuffle_path(path, sizeof(path), i, part);
+            // a missing run means the task emitted nothing for the partition
+            if (Run_open(&reader, path)) load_run(&reader, part);
+        }
+    } else if (shuffle_kind == CLUSTER_SHUFFLE_SOCKET) {
+        bool fetched = Shuffle_fetch(reduce_sources, reduce_source_count, part, fetch_compress,
+                                     fetch_in_flight, load_fetched, &part);
+        reduce_source_count = 0;
+        // the task runs again once the output that could not be fetched is
+        // available
+        if (!fetched) load_failed = true;
+    } else {
+        // records are parsed in place from the mapped segments, whose
+        // descriptors the mappings do not need
+        for (unsigned int i = 0; i < reduce_seg_count; i++) {
+            if (Run_open_fd(&reader, reduce_segs[i])) load_run(&reader, part);
+            close(reduce_segs[i]);
+        }
+        reduce_seg_count = 0;
+    }
+    if (load_failed) {
+        // drop what was loaded before the runs it points into
+        Core_clear_partition(part);
+        close_runs();
+        return false;
+    }
+
+    result_attempt = attempt;
+    Core_reduce_partition(part, cluster_reducer);
+    close_runs();
+    if (!result_file) return true;
+    bool ok = fclose(result_file) == 0;
+    result_file = NULL;
+    return ok;
+}
+
+// Run the tasks the coordinator sends until it closes the socket
+static void worker_main(int sock) {
+    writers = calloc(part_count, sizeof(RunWriter *));
+    segments = malloc(part_count * sizeof(int));
+    reduce_segs = malloc((map_count + 1) * sizeof(int));
+    reduce_sources = malloc((map_count + 1) * sizeof(ShuffleSource));
+    reduce_runs = malloc((map_count + 1) * sizeof(RunReader));
+    if (!writers || !segments || !reduce_segs || !reduce_sources || !reduce_runs) _exit(1);
+    for (unsigned int p = 0; p < part_count; p++) segments[p] = -1;
+    Core_set_output(cluster_output);
+
+    if (shuffle_kind == CLUSTER_SHUFFLE_SOCKET) {
+        // a reducer that goes away mid-fetch must not kill the server
+        signal(SIGPIPE, SIG_IGN);
+        server = Shuffle_serve();
+        if (!server) _exit(1);
+    }
+
+    ClusterMsg msg;
+    int fds[SEG_BATCH];
+    while (recv_msg(sock, &msg, fds)) {
+        if (msg.type == MSG_SEGMENTS) {
+            // segments of the next reduce task
+            for (unsigned int i = 0; i < msg.count; i++) {
+                if (reduce_seg_count < map_count) {
+                    reduce_segs[reduce_seg_count++] = fds[i];
+                } else {
+                    close(fds[i]);
+                }
+            }
+            continue;
+        }
+        if (msg.type == MSG_LOCATIONS) {
+            // servers to fetch the next reduce task's runs from
+            for (unsigned int i = 0; i < msg.count && i < SEG_BATCH; i++) {
+                if (reduce_source_count == map_count) break;
+                reduce_sources[reduce_source_count].map = msg.parts[i];
+                reduce_sources[reduce_source_count++].port = msg.ports[i];
+            }
+            continue;
+        }
+
+        bool ok = msg.type == MSG_MAP ? run_map_task(sock, msg.task)
+                                      : run_reduce_task(msg.task, msg.attempt);
+        msg.type = ok ? MSG_DONE : MSG_FAILED;
+        msg.port = server ? Shuffle_port(server) : 0;
+        if (!send_msg(sock, &msg, NULL, 0)) break;
+    }
+    _exit(0);
+}
+
+// Fork a worker into slot w
+static bool spawn_worker(Worker *workers, unsigned int n, unsigned int w) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0) return false;
+
+    fflush(NULL);  // or buffered output would be written twice
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // only the coordinator may hold the other workers' sockets, or they
+        // would not see it close them, and the shuffle segments, or their
+        // memory would outlive the reduce tasks
+        close(sv[0]);
+        for (unsigned int i = 0; i < n; i++) {
+            if (workers[i].sock >= 0) close(workers[i].sock);
+        }
+        for (size_t i = 0; shuffle_fds && i < (size_t)map_count * part_count; i++) {
+            if (shuffle_fds[i] >= 0) close(shuffle_fds[i]);
+        }
+        worker_main(sv[1]);
+    }
+
+    close(sv[1]);
+    workers[w].pid = pid;
+    workers[w].sock = sv[0];
+    workers[w].task = -1;
+    return true;
+}
+
+// Wait for a worker that exited (or was killed) and free its slot
+static void reap_worker(Worker *worker) {
+    close(worker->sock);
+    waitpid(worker->pid, NULL, 0);
+    worker->sock = -1;
+    worker->task = -1;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Kill the workers whose task ran past the task timeout; their socket then
+// closes and the task is retried as a crashed worker's would be
+static void expire_tasks(Worker *workers, unsigned int n) {
+    long long now = now_ms();
+    for (unsigned int w = 0; w < n; w++) {
+        if (workers[w].task < 0 || workers[w].deadline_ms == 0 || now < workers[w].deadline_ms) {
+            continue;
+        }
+        kill(workers[w].pid, SIGKILL);
+        workers[w].deadline_ms = 0;
+    }
+}
+
+// Send the servers holding the output of every map task
+static bool send_locations(int sock, unsigned int task) {
+    for (unsigned int i = 0; i < map_count; i += SEG_BATCH) {
+        unsigned int count = map_count - i < SEG_BATCH ? map_count - i : SEG_BATCH;
+        ClusterMsg msg = { MSG_LOCATIONS, task, 0, count };
+        for (unsigned int k = 0; k < msg.count; k++) {
+            msg.parts[k] = i + k;
+            msg.ports[k] = map_ports[i + k];
+        }
+        if (!send_msg(sock, &msg, NULL, 0)) return false;
+    }
+    return true;
+}
+
+// Send a task to a worker, preceded by the segments of a reduce task or
+// the locations of its map output
+static bool send_task(Worker *worker, MsgType type, unsigned int task, unsigned int attempt) {
+    if (type == MSG_REDUCE && map_ports && !send_locations(worker->sock, task)) return false;
+    if (type == MSG_REDUCE && shuffle_fds) {
+        int *fds = malloc((map_count + 1) * sizeof(int));
+        unsigned int *parts = malloc((map_count + 1) * sizeof(unsigned int));
+        unsigned int count = 0;
+        for (unsigned int i = 0; fds && parts && i < map_count; i++) {
+            int fd = shuffle_fds[(size_t)i * part_count + task];
+            if (fd < 0) continue;
+            fds[count] = fd;
+            parts[count++] = task;
+        }
+        bool sent = fds && parts && send_segments(worker->sock, task, fds, parts, count);
+        free(fds);
+        free(parts);
+        if (!sent) return false;
+    }
+    ClusterMsg msg = { type, task, attempt, 0 };
+    return send_msg(worker->sock, &msg, NULL, 0);
+}
+
+// Keep the segments a worker sends for its map task, replacing those of
+// an earlier attempt of the task
+static void store_segments(Worker *worker, MsgType type, const ClusterMsg *msg, const int *fds) {
+    for (unsigned int i = 0; i < msg->count; i++) {
+        if (type != MSG_MAP || !shuffle_fds || worker->task != (int)msg->task ||
+            msg->parts[i] >= part_count) {
+            close(fds[i]);
+            continue;
+        }
+        int *slot = &shuffle_fds[(size_t)msg->task * part_count + msg->parts[i]];
+        if (*slot >= 0) close(*slot);
+        *slot = fds[i];
+    }
+}
+
+// Release the segments of a reduced partition
+static void drop_segments(unsigned int part) {
+    for (unsigned int i = 0; shuffle_fds && i < map_count; i++) {
+        int *slot = &shuffle_fds[(size_t)i * part_count + part];
+        if (*slot >= 0) close(*slot);
+        *slot = -1;
+    }
+}
+
+// Put the map tasks whose output was served by a dead worker back to
+// pending; returns how many there were
+static unsigned int lose_output(pid_t pid) {
+    unsigned int lost = 0;
+    for (unsigned int i = 0; map_owners && i < map_count; i++) {
+        if (map_tasks[i].state != TASK_DONE || map_owners[i] != pid) continue;
+        // losing the output is not the task's failure
+        map_tasks[i].state = TASK_PENDING;
+        map_tasks[i].attempts = 0;
+        lost++;
+    }
+    return lost;
+}
+
+// Run the unfinished tasks of a phase on the workers, retrying the tasks
+// of workers that fail or crash on a new worker. When map output the
+// reduce phase needs dies with its worker, the reduce tasks already
+// running are let finish and PHASE_LOST is returned.
+static PhaseResult run_phase(Worker *workers, unsigned int n, MsgType type, Task *tasks,
+                             unsigned int count) {
+    struct pollfd *pfds = malloc(n * sizeof(struct pollfd));
+    if (!pfds) return PHASE_FAILED;
+    unsigned int done = 0, running = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (tasks[i].state == TASK_DONE) done++;
+        if (tasks[i].state == TASK_RUNNING) tasks[i].state = TASK_PENDING;
+    }
+    bool ok = true, lost = false;
+
+    while (ok && (lost ? running > 0 : done < count)) {
+        if (MR_Cancelled()) {
+            ok = false;
+            break;
+        }
+
+        // hand pending tasks to idle workers, replacing crashed ones
+        unsigned int next = 0, alive = 0;
+        for (unsigned int w = 0; w < n; w++) {
+            if (workers[w].sock < 0 && !spawn_worker(workers, n, w)) continue;
+            alive++;
+            if (workers[w].task >= 0 || lost) continue;
+
+            while (next < count && tasks[next].state != TASK_PENDING) next++;
+            if (next == count) continue;
+
+            if (!send_task(&workers[w], type, next, tasks[next].attempts + 1)) {
+                reap_worker(&workers[w]);
+                continue;
+            }
+            tasks[next].state = TASK_RUNNING;
+            tasks[next].attempts++;
+            workers[w].task = (int)next;
+            unsigned int timeout = Core_task_timeout();
+            workers[w].deadline_ms = timeout ? now_ms() + timeout : 0;
+            running++;
+        }
+        if (alive == 0) {
+            perror("mrcluster: cannot start workers");
+            ok = false;
+            break;
+        }
+
+        // wait for results
+        for (unsigned int w = 0; w < n; w++) {
+            pfds[w].fd = workers[w].sock;
+            pfds[w].events = POLLIN;
+            pfds[w].revents = 0;
+        }
+        expire_tasks(workers, n);
+        if (poll(pfds, n, CLUSTER_POLL_MS) <= 0) continue;
+
+        for (unsigned int w = 0; w < n; w++) {
+            if (pfds[w].fd < 0 || pfds[w].revents == 0) continue;
+
+            ClusterMsg msg;
+            int fds[SEG_BATCH];
+            bool got = recv_msg(workers[w].sock, &msg, fds);
+            int task = workers[w].task;
+            if (got && msg.type == MSG_SEGMENTS) {
+                store_segments(&workers[w], type, &msg, fds);
+                continue;
+            }
+            if (task >= 0) running--;
+            if (got && msg.type == MSG_DONE && task >= 0 && msg.task == (unsigned int)task) {
+                tasks[task].state = TASK_DONE;
+                workers[w].task = -1;
+                done++;
+                if (type == MSG_REDUCE) drop_segments(task);
+                if (type == MSG_MAP && map_ports) {
+                    map_ports[task] = msg.port;
+                    map_owners[task] = workers[w].pid;
+                }
+                continue;
+            }
+
+            // the worker crashed, or its task failed
+            bool forgiven = got && lost;  // most likely a fetch of the lost output
+            if (!got) {
+                pid_t pid = workers[w].pid;
+                reap_worker(&workers[w]);
+                unsigned int gone = lose_output(pid);
+                if (type == MSG_MAP) {
+                    done -= gone;
+                } else if (gone > 0) {
+                    lost = true;
+                }
+            }
+            workers[w].task = -1;
+            if (task < 0) continue;
+            if (forgiven) {
+                tasks[task].state = TASK_PENDING;
+                tasks[task].attempts--;
+            } else if (tasks[task].attempts >= CLUSTER_MAX_ATTEMPTS) {
+                fprintf(stderr, "mrcluster: %s task %d failed %u times, giving up\n",
+                        type == MSG_MAP ? "map" : "reduce", task, tasks[task].attempts);
+                ok = false;
+            } else {
+                tasks[task].state = TASK_PENDING;
+            }
+        }
+    }
+
+    free(pfds);
+    if (!ok) return PHASE_FAILED;
+    return lost && done < count ? PHASE_LOST : PHASE_DONE;
+}
+
+// Stop the workers: an orderly shutdown lets them finish, otherwise they
+// are killed in the middle of their tasks
+static void stop_workers(Worker *workers, unsigned int n, bool kill_them) {
+    for (unsigned int w = 0; w < n; w++) {
+        if (workers[w].sock < 0) continue;
+        if (kill_them) kill(workers[w].pid, SIGKILL);
+        reap_worker(&workers[w]);
+    }
+}
+
+// Set up the shuffle: a directory for run files, a table of segments
+// (which needs a descriptor per map task and partition) or a table of the
+// servers holding map output
+static bool create_shuffle(void) {
+    if (shuffle_kind == CLUSTER_SHUFFLE_FILES) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(shuffle_dir, sizeof(shuffle_dir), "%s/mrcluster-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+        if (mkdtemp(shuffle_dir)) return true;
+        perror("mrcluster: cannot create the shuffle directory");
+        return false;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (shuffle_kind == CLUSTER_SHUFFLE_SOCKET) {
+        map_ports = calloc(map_count + 1, sizeof(unsigned short));
+        map_owners = calloc(map_count + 1, sizeof(pid_t));
+        return map_ports && map_owners;
+    }
+    size_t slots = (size_t)map_count * part_count;
+    shuffle_fds = malloc((slots + 1) * sizeof(int));
+    if (!shuffle_fds) return false;
+    for (size_t i = 0; i < slots; i++) shuffle_fds[i] = -1;
+    return true;
+}
+
+// Release the shuffle: the segments, the server table, or the directory
+// including the temporary runs of attempts that crashed
+static void destroy_shuffle(void) {
+    if (shuffle_kind == CLUSTER_SHUFFLE_SOCKET) {
+        // the map output went away with the workers
+        free(map_ports);
+        free(map_owners);
+        map_ports = NULL;
+        map_owners = NULL;
+        return;
+    }
+    if (shuffle_kind == CLUSTER_SHUFFLE_SHM) {
+        for (unsigned int p = 0; p < part_count; p++) drop_segments(p);
+        free(shuffle_fds);
+        shuffle_fds = NULL;
+        return;
+    }
+
+    DIR *dir = opendir(shuffle_dir);
+    if (dir) {
+        struct dirent *ent;
+        char path[PATH_MAX + 256];
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", shuffle_dir, ent->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(shuffle_dir);
+}
+
+// Collect the inputs the input layer has made readable
+static void collect_input(InputFile *file, void *ctx) {
+    pthread_mutex_lock(&inputs_lock);
+    inputs[map_count++] = file;
+    pthread_mutex_unlock(&inputs_lock);
+}
+
+// Comparison function for running the smaller inputs first, as the pool does
+static int compare_input_size(const void *a, const void *b) {
+    const InputFile *fa = *(InputFile *const *)a;
+    const InputFile *fb = *(InputFile *const *)b;
+    if (fa->size > fb->size) return 1;
+    if (fa->size < fb->size) return -1;
+    return 0;
+}
+
+// Run a job on worker processes
+void MR_RunCluster(unsigned int file_count, char *file_names[],
+                   Mapper mapper, Reducer reducer,
+                   unsigned int num_procs, unsigned int num_parts) {
+    if (num_procs == 0 || num_parts == 0) return;
+    Core_init(mapper, num_parts);
+    cluster_mapper = mapper;
+    cluster_reducer = reducer;
+    part_count = num_parts;
+
+    // the workers read the inputs through descriptors they inherit, so
+    // pipes, which the input layer reads in blocks over time, are left out
+    char **names = malloc(file_count * sizeof(char *));
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < file_count; i++) {
+        struct stat st;
+        if (strcmp(file_names[i], "-") == 0 ||
+            (stat(file_names[i], &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))) {
+            fprintf(stderr, "mrcluster: %s: pipe inputs are not supported in cluster mode\n",
+                    file_names[i]);
+            continue;
+        }
+        names[count++] = file_names[i];
+    }
+
+    // decompress inputs up front; the pool is gone before the first fork
+    InputFile *files = malloc(count * sizeof(InputFile));
+    inputs = malloc(count * sizeof(InputFile *));
+    map_count = 0;
+    ThreadPool_t *tp = ThreadPool_create(num_procs);
+    Input_prepare_all(tp, count, names, files, collect_input, NULL);
+    Core_wait(tp);
+    ThreadPool_destroy(tp);
+    qsort(inputs, map_count, sizeof(InputFile *), compare_input_size);
+
+    bool ok = create_shuffle();
+    if (ok) {
+        Worker *workers = malloc(num_procs * sizeof(Worker));
+        map_tasks = calloc(map_count + 1, sizeof(Task));
+        Task *reduce_tasks = calloc(num_parts, sizeof(Task));
+        for (unsigned int w = 0; w < num_procs; w++) {
+            workers[w].sock = -1;
+            workers[w].task = -1;
+        }
+
+        // map output lost with its worker is mapped again, and the
+        // partitions not yet reduced wait for it
+        PhaseResult result = PHASE_LOST;
+        while (result == PHASE_LOST) {
+            result = run_phase(workers, num_procs, MSG_MAP, map_tasks, map_count);
+            if (result == PHASE_DONE) {
+                result = run_phase(workers, num_procs, MSG_REDUCE, reduce_tasks, num_parts);
+            }
+        }
+        ok = result == PHASE_DONE;
+        stop_workers(workers, num_procs, !ok);
+        free(workers);
+        free(map_tasks);
+        map_tasks = NULL;
+        free(reduce_tasks);
+        destroy_shuffle();
+    }
+    if (!ok) MR_Cancel();  // so that MR_Cancelled reports the failure
+
+    Input_release(files, count);
+    free(files);
+    free(inputs);
+    inputs = NULL;
+    free(names);
+    Core_finish();
+}
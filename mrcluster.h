@@ -0,0 +1,68 @@
+// Local cluster mode: a coordinator process hands map and reduce tasks to
+// worker processes over Unix domain sockets, and the shuffle between them
+// goes through shared memory, run files or a socket service.
+#ifndef MRCLUSTER_H
+#define MRCLUSTER_H
+#include "mapreduce.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// How map output reaches the reduce tasks
+typedef enum {
+    CLUSTER_SHUFFLE_SHM,   // memfd segments passed between processes (default)
+    CLUSTER_SHUFFLE_FILES,  // run files in a directory under $TMPDIR (or /tmp)
+    CLUSTER_SHUFFLE_SOCKET  // served by the map workers, fetched over TCP
+} ClusterShuffle;
+
+/**
+* Choose the shuffle transport of MR_RunCluster. With CLUSTER_SHUFFLE_SHM
+* each map task writes one memfd segment per partition and hands the
+* descriptors to the coordinator, which passes them on to the reduce task;
+* reducers map the segments and read the records in place, so the shuffle
+* never touches the file system. CLUSTER_SHUFFLE_FILES keeps the shuffle
+* in files instead, for jobs whose map output does not fit in memory.
+* With CLUSTER_SHUFFLE_SOCKET the map output stays with the worker that
+* produced it, which serves it over a loopback TCP port; reduce tasks fetch
+* their runs from every server at once (see MR_SetClusterFetch), as they
+* would from other machines. If a worker holding map output dies, its map
+* tasks run again.
+* Parameters:
+*     shuffle - Transport to use
+*/
+void MR_SetClusterShuffle(ClusterShuffle shuffle);
+
+/**
+* Tune how reduce tasks fetch their runs with CLUSTER_SHUFFLE_SOCKET
+* Parameters:
+*     compress      - Whether blocks are sent zlib-compressed (when the
+*                     library is built with zlib and a block shrinks)
+*     max_in_flight - Bound on the bytes a reduce task has requested but
+*                     not yet received (0: 8 MiB)
+*/
+void MR_SetClusterFetch(bool compress, size_t max_in_flight);
+
+/**
+* Run a MapReduce job on worker processes forked from the caller. Each map
+* task writes its output as one run per partition into the shuffle (see
+* MR_SetClusterShuffle); each reduce task loads the runs of its partition
+* and reduces it. A task whose worker crashes or fails is retried on a
+* fresh worker, up to 3 attempts, after which the job stops and
+* MR_Cancelled reports it.
+* Parameters:
+*     file_count - Number of input files (plain or compressed; pipes are
+*                  not supported and are skipped)
+*     file_names - Array of input file names
+*     mapper     - Function pointer to the map function
+*     reducer    - Function pointer to the reduce function
+*     num_procs  - Number of worker processes
+*     num_parts  - Number of partitions (and of reduce tasks)
+* Note: results written with MR_Output go to result-<partition>.txt, which
+*       a retried reduce task rewrites; the mapper and reducer run in the
+*       workers, so changes they make to global state are not seen by the
+*       caller
+*/
+void MR_RunCluster(unsigned int file_count, char *file_names[],
+                   Mapper mapper, Reducer reducer,
+                   unsigned int num_procs, unsigned int num_parts);
+
+#endif
@@ -0,0 +1,161 @@
+// Framework internals shared by the engines built on the partitions of
+// mapreduce.c. Not part of the public API.
+#ifndef MRCORE_H
+#define MRCORE_H
+#include "mapreduce.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+// Receives a reduce result written with MR_Output
+typedef void (*OutputFn)(char *key, char *value, unsigned int partition_idx);
+
+// Receives a record emitted with MR_Emit, with its partition
+typedef void (*EmitFn)(char *key, char *value, unsigned int partition_idx);
+
+/**
+* Set up empty partitions for a job
+* Parameters:
+*     mapper    - Map function run by Core_map_input jobs
+*     num_parts - Number of partitions to be created
+*/
+void Core_init(Mapper mapper, unsigned int num_parts);
+
+/**
+* Submit a map job for an input
+* Parameters:
+*     tp   - Pointer to the ThreadPool object that runs the job
+*     file - Input handed out by the input layer; released with Input_done
+*/
+void Core_map_input(ThreadPool_t *tp, InputFile *file);
+
+/**
+* Submit a task of the running job, which MR_Cancel and the task timeout
+* (MR_SetTaskTimeout) apply to
+* Parameters:
+*     tp   - Pointer to the ThreadPool object that runs the task
+*     func - Task function
+*     arg  - Argument of func
+*     size - Size of the task, for the job queue's order
+* Return:
+*     true  - On success
+*     false - If the task could not be queued
+*/
+bool Core_add_task(ThreadPool_t *tp, thread_func_t func, void *arg, size_t size);
+
+/**
+* Wait until the pool has run all its jobs, cancelling the job if a task
+* runs past its timeout
+* Parameters:
+*     tp - Pointer to the ThreadPool object to wait for
+*/
+void Core_wait(ThreadPool_t *tp);
+
+/**
+* Get the time limit per task set with MR_SetTaskTimeout
+* Return:
+*     unsigned int - Milliseconds, or 0 for no limit
+*/
+unsigned int Core_task_timeout(void);
+
+/**
+* Estimate the distinct keys a mapper emits, by mapping the first lines of
+* an input (what it emits goes nowhere else) and extrapolating the keys as
+* MR_Estimate does
+* Parameters:
+*     mapper      - Map function of the job
+*     name        - Input to sample (plain regular files only)
+*     total_bytes - Bytes of input to extrapolate to, e.g. the input's size
+* Return:
+*     double - Estimated keys, or 0 if the input cannot be sampled (too
+*              small, compressed, not a regular file)
+*/
+double Core_sample_keys(Mapper mapper, const char *name, double total_bytes);
+
+/**
+* Add a record to a partition in place: the partition points at the key
+* and value instead of copying them (a combining partition still copies
+* them into its table), and MR_GetNext copies only the values a reducer
+* takes
+* Parameters:
+*     idx   - Partition of the record
+*     key   - Key, which must stay valid until the partition is reduced or
+*             cleared, e.g. in a run mapped until then
+*     value - Value, under the same condition
+* Return:
+*     true  - On success
+*     false - Out of memory
+*/
+bool Core_add_mapped(unsigned int idx, char *key, char *value);
+
+/**
+* Route MR_Output to a callback instead of the result files
+* Parameters:
+*     fn - Callback, or NULL to restore the result files
+*/
+void Core_set_output(OutputFn fn);
+
+/**
+* Route MR_Emit to a callback instead of the partitions
+* Parameters:
+*     fn - Callback, or NULL to restore the partitions
+*/
+void Core_set_emit(EmitFn fn);
+
+/**
+* Tag the records the calling thread emits from now on. Within a key,
+* records are ordered by tag, so a reducer sees the values of tag 0 first.
+* Parameters:
+*     tag - Tag (0 to 255; 0 is the default)
+*/
+void Core_set_tag(unsigned int tag);
+
+/**
+* Get the next value of a key that carries a tag. Values of the key with
+* lower tags that have not been read are dropped.
+* Parameters:
+*     key           - Key of the values being reduced
+*     partition_idx - Index of the partition containing this key
+*     tag           - Tag of the value
+* Return:
+*     char * - Value, as MR_GetNext returns it
+*     NULL   - If the key has no more values with the tag
+*/
+char *Core_next_tagged(char *key, unsigned int partition_idx, unsigned int tag);
+
+/**
+* Compare two keys in the order set with MR_SetKeyOrder
+* Return:
+*     int - Negative, zero or positive as a orders before, with or after b
+*/
+int Core_compare_keys(const char *a, const char *b);
+
+/**
+* Reduce one partition on the calling thread
+* Parameters:
+*     idx     - Partition to reduce
+*     reducer - Reduce function
+*/
+void Core_reduce_partition(unsigned int idx, Reducer reducer);
+
+/**
+* Drop the records of one partition without reducing them
+* Parameters:
+*     idx - Partition to empty
+*/
+void Core_clear_partition(unsigned int idx);
+
+/**
+* Reduce every partition and wait for the reducers to finish. The
+* partitions are left empty and can take the next batch of map output.
+* Parameters:
+*     tp      - Pointer to the ThreadPool object that runs the reduce jobs
+*     reducer - Reduce function
+*/
+void Core_reduce(ThreadPool_t *tp, Reducer reducer);
+
+/**
+* Release the partitions
+*/
+void Core_finish(void);
+
+#endif
@@ -0,0 +1,141 @@
+#include "mrcounter.h"
+#include "mrtable.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SLOTS 16
+#define CACHE_LINE 64
+
+// One slot, alone on its cache line so that updates of neighbouring keys
+// do not contend. A key claims an empty slot by setting its hash, then
+// publishes its copy of the key; readers with the same hash wait for it.
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_uint_fast64_t hash;  // 0 if the slot is empty
+    _Atomic(char *) key;
+    atomic_llong value;
+} Slot;
+
+struct CounterMap {
+    Slot *slots;
+    size_t mask;      // slot count - 1 (a power of two)
+    size_t max_keys;
+    atomic_size_t count;
+    CounterOp op;
+};
+
+// Hash of a key, never 0 (which marks empty slots)
+static uint64_t hash_key(const char *key) {
+    uint64_t hash = Table_hash(key);
+    return hash ? hash : 1;
+}
+
+// Key of a claimed slot, once its claimer has published it
+static const char *slot_key(Slot *slot) {
+    const char *key;
+    while ((key = atomic_load_explicit(&slot->key, memory_order_acquire)) == NULL) {
+    }
+    return key;
+}
+
+// Create an empty map
+CounterMap *Counter_create(size_t max_keys, CounterOp op) {
+    CounterMap *map = malloc(sizeof(CounterMap));
+    if (!map) return NULL;
+    size_t count = MIN_SLOTS;
+    while (count < 2 * max_keys && count < SIZE_MAX / (4 * sizeof(Slot))) count *= 2;
+    map->slots = aligned_alloc(CACHE_LINE, count * sizeof(Slot));
+    if (!map->slots) {
+        free(map);
+        return NULL;
+    }
+    long long initial = op == COUNTER_MIN ? LLONG_MAX : op == COUNTER_MAX ? LLONG_MIN : 0;
+    for (size_t i = 0; i < count; i++) {
+        atomic_init(&map->slots[i].hash, 0);
+        atomic_init(&map->slots[i].key, NULL);
+        atomic_init(&map->slots[i].value, initial);
+    }
+    map->mask = count - 1;
+    map->max_keys = max_keys;
+    atomic_init(&map->count, 0);
+    map->op = op;
+    return map;
+}
+
+// Slot holding key, claiming an empty one for it if add is set
+static Slot *find_slot(CounterMap *map, const char *key, bool add) {
+    uint64_t hash = hash_key(key);
+    char *copy = NULL;
+    size_t s = hash & map->mask;
+    for (size_t probes = 0; probes <= map->mask; probes++, s = (s + 1) & map->mask) {
+        Slot *slot = &map->slots[s];
+        uint_fast64_t held = atomic_load_explicit(&slot->hash, memory_order_acquire);
+        if (held == 0) {
+            if (!add || atomic_load_explicit(&map->count, memory_order_relaxed) >= map->max_keys) break;
+            if (!copy && !(copy = strdup(key))) return NULL;
+            if (atomic_compare_exchange_strong(&slot->hash, &held, hash)) {
+                atomic_store_explicit(&slot->key, copy, memory_order_release);
+                atomic_fetch_add_explicit(&map->count, 1, memory_order_relaxed);
+                return slot;
+            }
+            // another key took the slot first: it may be this one
+        }
+        if (held == hash && strcmp(slot_key(slot), key) == 0) {
+            free(copy);
+            return slot;
+        }
+    }
+    free(copy);
+    return NULL;
+}
+
+// Fold a value into a key's
+bool Counter_add(CounterMap *map, const char *key, long long value) {
+    Slot *slot = find_slot(map, key, true);
+    if (!slot) return false;
+    if (map->op == COUNTER_SUM) {
+        atomic_fetch_add_explicit(&slot->value, value, memory_order_relaxed);
+        return true;
+    }
+    long long held = atomic_load_explicit(&slot->value, memory_order_relaxed);
+    while ((map->op == COUNTER_MIN ? value < held : value > held) &&
+           !atomic_compare_exchange_weak_explicit(&slot->value, &held, value,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return true;
+}
+
+// Look a key up
+bool Counter_get(const CounterMap *map, const char *key, long long *value) {
+    Slot *slot = find_slot((CounterMap *)map, key, false);
+    if (!slot) return false;
+    *value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+    return true;
+}
+
+// Get the number of keys in a map
+size_t Counter_count(const CounterMap *map) {
+    return atomic_load(&((CounterMap *)map)->count);
+}
+
+// Visit every entry of a map
+void Counter_foreach(const CounterMap *map, CounterVisit visit, void *ctx) {
+    for (size_t i = 0; i <= map->mask; i++) {
+        Slot *slot = &map->slots[i];
+        char *key = atomic_load(&slot->key);
+        if (key) visit(key, atomic_load(&slot->value), ctx);
+    }
+}
+
+// Free a map and its keys
+void Counter_free(CounterMap *map) {
+    if (!map) return;
+    for (size_t i = 0; i <= map->mask; i++) {
+        free(atomic_load(&map->slots[i].key));
+    }
+    free(map->slots);
+    free(map);
+}
@@ -0,0 +1,79 @@
+// Counter maps: fixed-size open-addressing hash tables of integer values
+// that any number of threads update at once without locks. A key claims
+// its slot with a compare-and-swap and its value is then updated with
+// atomic instructions, so threads only contend on the slots of the keys
+// they share.
+#ifndef MRCOUNTER_H
+#define MRCOUNTER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct CounterMap CounterMap;
+
+// How the values of a key are folded
+typedef enum {
+    COUNTER_SUM,  // added up
+    COUNTER_MIN,  // the least kept
+    COUNTER_MAX   // the greatest kept
+} CounterOp;
+
+/**
+* Receive an entry of a counter map
+*/
+typedef void (*CounterVisit)(const char *key, long long value, void *ctx);
+
+/**
+* Create an empty map
+* Parameters:
+*     max_keys - Number of keys the map must hold; it does not grow
+*     op       - How values of a key are folded
+* Return:
+*     CounterMap* - Map, or NULL if out of memory
+*/
+CounterMap *Counter_create(size_t max_keys, CounterOp op);
+
+/**
+* Fold a value into the value of a key, adding the key if new. Safe to
+* call from any number of threads at once.
+* Parameters:
+*     map   - Map to update
+*     key   - Key (copied when added)
+*     value - Value to fold in
+* Return:
+*     true  - On success
+*     false - If the key is new and the map is full, or out of memory
+*/
+bool Counter_add(CounterMap *map, const char *key, long long value);
+
+/**
+* Look a key up
+* Parameters:
+*     map   - Map to read
+*     key   - Key to find
+*     value - Set to the value of the key, if found
+* Return:
+*     true  - If the map has the key
+*     false - Otherwise
+*/
+bool Counter_get(const CounterMap *map, const char *key, long long *value);
+
+/**
+* Get the number of keys in a map
+*/
+size_t Counter_count(const CounterMap *map);
+
+/**
+* Visit every entry of a map, in no set order; no thread may be updating it
+* Parameters:
+*     map   - Map to visit
+*     visit - Called once per entry
+*     ctx   - Passed through to visit
+*/
+void Counter_foreach(const CounterMap *map, CounterVisit visit, void *ctx);
+
+/**
+* Free a map and its keys
+*/
+void Counter_free(CounterMap *map);
+
+#endif
@@ -0,0 +1,636 @@
+#define _GNU_SOURCE
+#include "mrflow.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKED_INITIAL_BYTES 4096
+
+typedef enum {
+    OP_TEXT,      // source: lines of text files
+    OP_MAP,       // narrow operators
+    OP_FLAT_MAP,
+    OP_FILTER,
+    OP_REDUCE,    // wide operators, each computed by a shuffle
+    OP_SORT,
+    OP_JOIN
+} OpKind;
+
+// One partition of a computed dataset, packed as key, NUL, value, NUL
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Packed;
+
+// Output of a wide operator
+typedef struct {
+    Packed *parts;
+    unsigned int count;
+    bool sorted;  // ordered by key across partitions (each one is sorted)
+} Dataset;
+
+struct Flow {
+    OpKind kind;
+    FlowPlan *plan;
+    Flow *in;            // input (NULL for sources)
+    Flow *right;         // right input of a join
+    FlowFn fn;
+    FlowPredicate pred;
+    FlowCombine combine;
+    FlowJoinFn join;
+    unsigned int file_count;  // sources
+    char **file_names;
+    Dataset *data;       // output of a wide operator once computed
+    unsigned int stage;  // stage number while explaining
+    Flow *next;          // next flow of the plan
+};
+
+struct FlowPlan {
+    Flow *flows;
+};
+
+// The narrow operators one input of a stage runs, fused into its map task
+typedef struct Chain {
+    Flow *source;     // text source, or wide operator whose dataset is read
+    Flow **ops;       // narrow operators, in order
+    unsigned int count;
+    unsigned char tag; // join side (0 left, 1 right)
+    void (*terminal)(struct Chain *chain, const char *key, const char *value);
+    InputFile *files; // of a text source while its map tasks run
+} Chain;
+
+struct FlowOut {
+    Chain *chain;
+    unsigned int next;  // operator the emitted records go to
+};
+
+// Arguments for map tasks
+typedef struct {
+    Chain *chain;
+    InputFile *file;  // text source
+    Packed *part;     // dataset partition
+} FlowTask;
+
+// Global variables
+static ThreadPool_t *pool = NULL;
+static unsigned int num_partitions = 0;
+static Dataset *current_output = NULL;  // of the shuffle being reduced
+static Flow *reducing = NULL;           // wide operator being reduced
+static FlowSink sink_fn = NULL;
+static void *sink_ctx = NULL;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Flow *new_flow(FlowPlan *plan, OpKind kind, Flow *in) {
+    if (!plan) return NULL;
+    Flow *flow = calloc(1, sizeof(Flow));
+    if (!flow) return NULL;
+    flow->kind = kind;
+    flow->plan = plan;
+    flow->in = in;
+    flow->next = plan->flows;
+    plan->flows = flow;
+    return flow;
+}
+
+static bool is_narrow(const Flow *flow) {
+    return flow->kind == OP_MAP || flow->kind == OP_FLAT_MAP || flow->kind == OP_FILTER;
+}
+
+static Dataset *dataset_new(unsigned int count) {
+    Dataset *data = calloc(1, sizeof(Dataset));
+    if (!data) return NULL;
+    data->parts = calloc(count, sizeof(Packed));
+    if (!data->parts) {
+        free(data);
+        return NULL;
+    }
+    data->count = count;
+    return data;
+}
+
+static void dataset_free(Dataset *data) {
+    if (!data) return;
+    for (unsigned int i = 0; i < data->count; i++) {
+        free(data->parts[i].data);
+    }
+    free(data->parts);
+    free(data);
+}
+
+static void packed_append(Packed *part, const char *key, const char *value) {
+    size_t klen = strlen(key) + 1, vlen = strlen(value) + 1;
+    if (part->len + klen + vlen > part->cap) {
+        size_t cap = part->cap ? part->cap : PACKED_INITIAL_BYTES;
+        while (cap < part->len + klen + vlen) cap *= 2;
+        char *grown = realloc(part->data, cap);
+        if (!grown) return;
+        part->data = grown;
+        part->cap = cap;
+    }
+    memcpy(part->data + part->len, key, klen);
+    memcpy(part->data + part->len + klen, value, vlen);
+    part->len += klen + vlen;
+}
+
+// Collect the narrow operators leading up to a flow, back to the source or
+// wide operator they read from
+static bool build_chain(Flow *end, Chain *chain) {
+    memset(chain, 0, sizeof(*chain));
+    unsigned int count = 0;
+    Flow *flow = end;
+    for (; is_narrow(flow); flow = flow->in) count++;
+    chain->source = flow;
+    chain->count = count;
+    chain->ops = malloc((count + 1) * sizeof(Flow *));
+    if (!chain->ops) return false;
+    for (flow = end; count > 0; flow = flow->in) {
+        chain->ops[--count] = flow;
+    }
+    return true;
+}
+
+// Run a record through the operators of a chain from operator i on
+static void apply(Chain *chain, unsigned int i, const char *key, const char *value) {
+    if (i == chain->count) {
+        chain->terminal(chain, key, value);
+        return;
+    }
+    Flow *op = chain->ops[i];
+    if (op->kind == OP_FILTER) {
+        if (op->pred(key, value)) apply(chain, i + 1, key, value);
+        return;
+    }
+    FlowOut out = { chain, i + 1 };
+    op->fn(key, value, &out);
+}
+
+// Pass a record on to the next operator
+void Flow_emit(FlowOut *out, const char *key, const char *value) {
+    apply(out->chain, out->next, key, value);
+}
+
+// Terminal of a stage's map task: the shuffle, with the join side as the
+// record's tag
+static void shuffle_terminal(Chain *chain, const char *key, const char *value) {
+    Core_set_tag(chain->tag);
+    MR_Emit((char *)key, (char *)value);
+}
+
+// Terminal of the records a join function emits: the join's dataset
+static void output_terminal(Chain *chain, const char *key, const char *value) {
+    MR_Output((char *)key, (char *)value);
+}
+
+// Terminal of the last stage: the sink
+static void sink_terminal(Chain *chain, const char *key, const char *value) {
+    pthread_mutex_lock(&sink_lock);
+    if (sink_fn) {
+        sink_fn(key, value, sink_ctx);
+    } else {
+        printf("%s: %s\n", key, value);
+    }
+    pthread_mutex_unlock(&sink_lock);
+}
+
+// MR_Output target while reducing a shuffle (each partition is reduced by
+// a single job, so its output needs no lock)
+static void flow_output(char *key, char *value, unsigned int partition_idx) {
+    packed_append(&current_output->parts[partition_idx], key, value);
+}
+
+// Map task reading a text file
+static void text_job(void *arg) {
+    FlowTask *task = (FlowTask *)arg;
+    FILE *fp = fopen(task->file->path, "r");
+    if (fp) {
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t len;
+        while ((len = getline(&line, &size, fp)) != -1 && !MR_Cancelled()) {
+            if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+            apply(task->chain, 0, task->file->name, line);
+        }
+        free(line);
+        fclose(fp);
+    }
+    Input_done(task->file);
+    free(task);
+}
+
+// Map task reading a partition of a dataset
+static void partition_job(void *arg) {
+    FlowTask *task = (FlowTask *)arg;
+    char *pos = task->part->data, *end = pos + task->part->len;
+    while (pos < end && !MR_Cancelled()) {
+        char *key = pos;
+        char *value = key + strlen(key) + 1;
+        pos = value + strlen(value) + 1;
+        apply(task->chain, 0, key, value);
+    }
+    free(task);
+}
+
+static void submit_text_job(InputFile *file, void *ctx) {
+    FlowTask *task = malloc(sizeof(FlowTask));
+    if (!task) {
+        Input_done(file);
+        return;
+    }
+    task->chain = (Chain *)ctx;
+    task->file = file;
+    task->part = NULL;
+    Core_add_task(pool, text_job, task, file->size);
+}
+
+// Submit the map tasks of one input of a stage
+static void start_chain(Chain *chain) {
+    Flow *source = chain->source;
+    if (source->kind == OP_TEXT) {
+        chain->files = malloc((source->file_count + 1) * sizeof(InputFile));
+        if (!chain->files) return;
+        Input_prepare(pool, source->file_count, source->file_names, chain->files,
+                      submit_text_job, chain);
+        return;
+    }
+    for (unsigned int p = 0; source->data && p < source->data->count; p++) {
+        FlowTask *task = malloc(sizeof(FlowTask));
+        if (!task) continue;
+        task->chain = chain;
+        task->file = NULL;
+        task->part = &source->data->parts[p];
+        Core_add_task(pool, partition_job, task, task->part->len);
+    }
+}
+
+// Release what the map tasks of a chain held, once they are done
+static void finish_chain(Chain *chain) {
+    if (chain->files) {
+        Input_release(chain->files, chain->source->file_count);
+        free(chain->files);
+    }
+    free(chain->ops);
+}
+
+// Deliver the records of a sorted dataset in key order, merging its
+// partitions
+static void merge_sorted(Chain *chain, Dataset *data) {
+    size_t *pos = calloc(data->count, sizeof(size_t));
+    if (!pos) return;
+    while (!MR_Cancelled()) {
+        int best = -1;
+        for (unsigned int p = 0; p < data->count; p++) {
+            if (pos[p] >= data->parts[p].len) continue;
+            if (best < 0 || Core_compare_keys(data->parts[p].data + pos[p],
+                                              data->parts[best].data + pos[best]) < 0) {
+                best = (int)p;
+            }
+        }
+        if (best < 0) break;
+        char *key = data->parts[best].data + pos[best];
+        char *value = key + strlen(key) + 1;
+        pos[best] = value + strlen(value) + 1 - data->parts[best].data;
+        apply(chain, 0, key, value);
+    }
+    free(pos);
+}
+
+// Reducer of Flow_reduce_by_key: fold the values of the key
+static void reduce_by_key(char *key, unsigned int partition_idx) {
+    char *acc = NULL, *value;
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        if (!acc) {
+            acc = value;
+            continue;
+        }
+        char *combined = reducing->combine(acc, value);
+        free(acc);
+        free(value);
+        acc = combined;
+        if (!acc) {
+            // out of memory: the results would be incomplete; the values
+            // left are dropped, or the key would be reduced again
+            MR_Cancel();
+            while ((value = MR_GetNext(key, partition_idx)) != NULL) free(value);
+            return;
+        }
+    }
+    if (acc) MR_Output(key, acc);
+    free(acc);
+}
+
+// Reducer of Flow_sort_by_key: keep every record, in key order
+static void sort_by_key(char *key, unsigned int partition_idx) {
+    char *value;
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        MR_Output(key, value);
+        free(value);
+    }
+}
+
+// Reducer of Flow_join: pair the values of the two sides, which the
+// shuffle orders left first, holding only the left ones
+static void join_by_key(char *key, unsigned int partition_idx) {
+    char **left = NULL;
+    size_t count = 0, cap = 0;
+    char *value;
+    while ((value = Core_next_tagged(key, partition_idx, 0)) != NULL) {
+        if (count == cap) {
+            cap = cap ? cap * 2 : 8;
+            char **grown = realloc(left, cap * sizeof(char *));
+            if (!grown) {
+                free(value);
+                continue;
+            }
+            left = grown;
+        }
+        left[count++] = value;
+    }
+
+    Chain chain = { 0 };
+    chain.terminal = output_terminal;
+    FlowOut out = { &chain, 0 };
+    while ((value = Core_next_tagged(key, partition_idx, 1)) != NULL) {
+        for (size_t l = 0; l < count; l++) {
+            if (reducing->join) {
+                reducing->join(key, left[l], value, &out);
+                continue;
+            }
+            size_t llen = strlen(left[l]), rlen = strlen(value);
+            char *pair = malloc(llen + rlen + 2);
+            if (!pair) continue;
+            memcpy(pair, left[l], llen);
+            pair[llen] = '\t';
+            memcpy(pair + llen + 1, value, rlen + 1);
+            MR_Output(key, pair);
+            free(pair);
+        }
+        free(value);
+    }
+    for (size_t l = 0; l < count; l++) {
+        free(left[l]);
+    }
+    free(left);
+}
+
+// Whether a sort reads the output of a shuffle directly
+static bool presorted(const Flow *wide) {
+    return wide->kind == OP_SORT && !is_narrow(wide->in) && wide->in->kind != OP_TEXT;
+}
+
+// Free the datasets of a plan's flows, some of which share theirs
+static void release_datasets(FlowPlan *plan) {
+    for (Flow *f = plan->flows; f; f = f->next) {
+        for (Flow *g = f->next; f->data && g; g = g->next) {
+            if (g->data == f->data) g->data = NULL;
+        }
+        dataset_free(f->data);
+        f->data = NULL;
+    }
+}
+
+// Compute a wide operator: the stage that reads its inputs through their
+// fused narrow operators and shuffles into it
+static Dataset *compute(Flow *wide) {
+    if (wide->data) return wide->data;
+    if (presorted(wide)) {
+        // the partitions of a shuffle are already sorted by key, so only
+        // the order they are merged in changes
+        wide->data = compute(wide->in);
+        if (wide->data) wide->data->sorted = true;
+        return wide->data;
+    }
+
+    unsigned int nsides = wide->kind == OP_JOIN ? 2 : 1;
+    Chain sides[2];
+    for (unsigned int s = 0; s < nsides; s++) {
+        if (!build_chain(s == 0 ? wide->in : wide->right, &sides[s])) {
+            if (s > 0) finish_chain(&sides[0]);
+            return NULL;
+        }
+        sides[s].terminal = shuffle_terminal;
+        sides[s].tag = s;
+    }
+    // the stages before run first, each with partitions of its own
+    for (unsigned int s = 0; s < nsides; s++) {
+        if (sides[s].source->kind != OP_TEXT) compute(sides[s].source);
+    }
+
+    Dataset *data = NULL;
+    if (!MR_Cancelled()) data = dataset_new(num_partitions);
+    if (data) {
+        // Map Phase: every input's fused operators feed the shuffle
+        for (unsigned int s = 0; s < nsides; s++) {
+            start_chain(&sides[s]);
+        }
+        Core_wait(pool);
+
+        // Reduce Phase: into the dataset of the operator
+        current_output = data;
+        reducing = wide;
+        Core_set_output(flow_output);
+        Core_reduce(pool, wide->kind == OP_REDUCE ? reduce_by_key :
+                          wide->kind == OP_SORT ? sort_by_key : join_by_key);
+        Core_set_output(NULL);
+        current_output = NULL;
+        reducing = NULL;
+        data->sorted = wide->kind == OP_SORT;
+    }
+    for (unsigned int s = 0; s < nsides; s++) {
+        finish_chain(&sides[s]);
+    }
+    wide->data = data;
+    return data;
+}
+
+// Create an empty plan
+FlowPlan *Flow_plan(void) {
+    return calloc(1, sizeof(FlowPlan));
+}
+
+// Free a plan and its flows
+void Flow_plan_free(FlowPlan *plan) {
+    if (!plan) return;
+    release_datasets(plan);
+    Flow *flow = plan->flows;
+    while (flow) {
+        Flow *next = flow->next;
+        for (unsigned int i = 0; i < flow->file_count; i++) {
+            free(flow->file_names[i]);
+        }
+        free(flow->file_names);
+        free(flow);
+        flow = next;
+    }
+    free(plan);
+}
+
+// Source reading text files
+Flow *Flow_text(FlowPlan *plan, unsigned int file_count, char *file_names[]) {
+    Flow *flow = new_flow(plan, OP_TEXT, NULL);
+    if (!flow) return NULL;
+    flow->file_names = malloc((file_count + 1) * sizeof(char *));
+    if (!flow->file_names) return NULL;
+    for (unsigned int i = 0; i < file_count; i++) {
+        flow->file_names[i] = strdup(file_names[i]);
+        if (flow->file_names[i]) flow->file_count++;
+    }
+    return flow;
+}
+
+Flow *Flow_map(Flow *in, FlowFn fn) {
+    Flow *flow = in ? new_flow(in->plan, OP_MAP, in) : NULL;
+    if (flow) flow->fn = fn;
+    return flow;
+}
+
+Flow *Flow_flat_map(Flow *in, FlowFn fn) {
+    Flow *flow = in ? new_flow(in->plan, OP_FLAT_MAP, in) : NULL;
+    if (flow) flow->fn = fn;
+    return flow;
+}
+
+Flow *Flow_filter(Flow *in, FlowPredicate pred) {
+    Flow *flow = in ? new_flow(in->plan, OP_FILTER, in) : NULL;
+    if (flow) flow->pred = pred;
+    return flow;
+}
+
+Flow *Flow_reduce_by_key(Flow *in, FlowCombine combine) {
+    Flow *flow = in ? new_flow(in->plan, OP_REDUCE, in) : NULL;
+    if (flow) flow->combine = combine;
+    return flow;
+}
+
+Flow *Flow_sort_by_key(Flow *in) {
+    return in ? new_flow(in->plan, OP_SORT, in) : NULL;
+}
+
+Flow *Flow_join(Flow *left, Flow *right, FlowJoinFn fn) {
+    Flow *flow = left && right ? new_flow(left->plan, OP_JOIN, left) : NULL;
+    if (flow) {
+        flow->right = right;
+        flow->join = fn;
+    }
+    return flow;
+}
+
+// Add two integer values
+char *Flow_sum(const char *a, const char *b) {
+    char *sum = malloc(24);
+    if (sum) snprintf(sum, 24, "%lld", strtoll(a, NULL, 10) + strtoll(b, NULL, 10));
+    return sum;
+}
+
+static const char *op_name(OpKind kind) {
+    switch (kind) {
+    case OP_TEXT: return "text";
+    case OP_MAP: return "map";
+    case OP_FLAT_MAP: return "flat_map";
+    case OP_FILTER: return "filter";
+    case OP_REDUCE: return "reduce_by_key";
+    case OP_SORT: return "sort_by_key";
+    case OP_JOIN: return "join";
+    }
+    return "?";
+}
+
+static unsigned int explain_stage(Flow *end, FILE *fp, unsigned int *stages);
+
+// Print one input of a stage: its source and fused operators
+static void explain_side(Chain *chain, FILE *fp) {
+    if (chain->source->kind == OP_TEXT) {
+        fprintf(fp, "text(%u files)", chain->source->file_count);
+    } else {
+        fprintf(fp, "stage %u", chain->source->stage);
+    }
+    for (unsigned int i = 0; i < chain->count; i++) {
+        fprintf(fp, " -> %s", op_name(chain->ops[i]->kind));
+    }
+}
+
+// Print the stages a flow needs, the ones it reads first; returns the
+// number of the stage ending with end
+static unsigned int explain_stage(Flow *end, FILE *fp, unsigned int *stages) {
+    bool wide = !is_narrow(end) && end->kind != OP_TEXT;
+    if (wide && end->stage) return end->stage;
+    if (presorted(end)) {
+        end->stage = explain_stage(end->in, fp, stages);
+        return end->stage;
+    }
+
+    Chain sides[2];
+    unsigned int nsides = end->kind == OP_JOIN ? 2 : 1;
+    for (unsigned int s = 0; s < nsides; s++) {
+        Flow *in = wide ? (s == 0 ? end->in : end->right) : end;
+        if (!build_chain(in, &sides[s])) return 0;
+        if (sides[s].source->kind != OP_TEXT) explain_stage(sides[s].source, fp, stages);
+    }
+
+    unsigned int stage = ++*stages;
+    fprintf(fp, "stage %u: ", stage);
+    for (unsigned int s = 0; s < nsides; s++) {
+        if (s > 0) fprintf(fp, " + ");
+        explain_side(&sides[s], fp);
+        free(sides[s].ops);
+    }
+    fprintf(fp, " => %s\n", wide ? op_name(end->kind) : "sink");
+    if (wide) end->stage = stage;
+    return stage;
+}
+
+// Print the stages a flow compiles into
+void Flow_explain(Flow *flow, FILE *fp) {
+    if (!flow) return;
+    unsigned int stages = 0;
+    explain_stage(flow, fp, &stages);
+    if (!is_narrow(flow) && flow->kind != OP_TEXT) {
+        fprintf(fp, "stage %u: stage %u => sink\n", stages + 1, flow->stage);
+    }
+    for (Flow *f = flow->plan->flows; f; f = f->next) {
+        f->stage = 0;
+    }
+}
+
+// Main dataflow execution function
+void Flow_run(Flow *flow, FlowSink sink, void *ctx,
+              unsigned int num_workers, unsigned int num_parts) {
+    if (!flow || num_parts == 0) return;
+    // every shuffle goes through the same partitions, which each reduce
+    // phase leaves empty
+    Core_init(NULL, num_parts);
+    pool = ThreadPool_create(num_workers);
+    num_partitions = num_parts;
+    sink_fn = sink;
+    sink_ctx = ctx;
+
+    // the last stage maps its input through the fused operators after the
+    // last shuffle straight into the sink
+    Chain chain;
+    if (build_chain(flow, &chain)) {
+        chain.terminal = sink_terminal;
+        Dataset *data = chain.source->kind == OP_TEXT ? NULL : compute(chain.source);
+        if (MR_Cancelled()) {
+            // stopped in an earlier stage
+        } else if (data && data->sorted) {
+            merge_sorted(&chain, data);
+        } else if (data || chain.source->kind == OP_TEXT) {
+            start_chain(&chain);
+            Core_wait(pool);
+        }
+        finish_chain(&chain);
+    }
+
+    // the datasets are only needed while the flow runs
+    release_datasets(flow->plan);
+    ThreadPool_destroy(pool);
+    Core_finish();
+    pool = NULL;
+    sink_fn = NULL;
+    sink_ctx = NULL;
+}
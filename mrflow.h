@@ -0,0 +1,127 @@
+// Lazy dataflow API: operators build a plan, and running it compiles the
+// plan into as few shuffles as it needs, fusing the narrow operators (map,
+// filter, flat map) between them into the map task of a single stage.
+#ifndef MRFLOW_H
+#define MRFLOW_H
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct FlowPlan FlowPlan;
+typedef struct Flow Flow;
+typedef struct FlowOut FlowOut;
+
+/**
+* Transform one record, passing the results on with Flow_emit
+* Parameters:
+*     key   - Key of the record
+*     value - Value of the record
+*     out   - Where the results go
+*/
+typedef void (*FlowFn)(const char *key, const char *value, FlowOut *out);
+
+/**
+* Decide whether to keep a record
+* Return:
+*     true  - To keep it
+*     false - To drop it
+*/
+typedef bool (*FlowPredicate)(const char *key, const char *value);
+
+/**
+* Combine two values of the same key
+* Return:
+*     char * - Combined value, allocated with malloc
+*/
+typedef char *(*FlowCombine)(const char *a, const char *b);
+
+/**
+* Produce the joined records of one value of each side for a key, with
+* Flow_emit
+*/
+typedef void (*FlowJoinFn)(const char *key, const char *left, const char *right,
+                           FlowOut *out);
+
+/**
+* Receive a record of the result
+*/
+typedef void (*FlowSink)(const char *key, const char *value, void *ctx);
+
+/**
+* Create an empty plan, which owns the flows built in it
+* Return:
+*     FlowPlan* - Plan, or NULL if out of memory
+*/
+FlowPlan *Flow_plan(void);
+
+/**
+* Free a plan and every flow built in it
+*/
+void Flow_plan_free(FlowPlan *plan);
+
+/**
+* Read text files, one record per line with the file name as key and the
+* line (without its newline) as value. Compressed files are read as MR_Run
+* reads them.
+*/
+Flow *Flow_text(FlowPlan *plan, unsigned int file_count, char *file_names[]);
+
+/**
+* Narrow operators, fused into the map task of the stage they belong to.
+* Flow_map's function emits one record per input record, Flow_flat_map's
+* any number.
+*/
+Flow *Flow_map(Flow *in, FlowFn fn);
+Flow *Flow_flat_map(Flow *in, FlowFn fn);
+Flow *Flow_filter(Flow *in, FlowPredicate pred);
+
+/**
+* Wide operators, each ending a stage with a shuffle.
+* Flow_reduce_by_key folds the values of each key with combine;
+* Flow_sort_by_key orders the records by key across partitions (in the
+* order set with MR_SetKeyOrder, strcmp by default);
+* Flow_join pairs every value of a key in left with every value of it in
+* right (fn NULL: emit key with "left\tright").
+*/
+Flow *Flow_reduce_by_key(Flow *in, FlowCombine combine);
+Flow *Flow_sort_by_key(Flow *in);
+Flow *Flow_join(Flow *left, Flow *right, FlowJoinFn fn);
+
+/**
+* Pass a record on to the next operator
+* Parameters:
+*     out   - FlowOut the operator was called with
+*     key   - Key of the record (copied by the operators that keep it)
+*     value - Value of the record
+*/
+void Flow_emit(FlowOut *out, const char *key, const char *value);
+
+/**
+* FlowCombine that adds two integer values
+*/
+char *Flow_sum(const char *a, const char *b);
+
+/**
+* Print the stages the plan of a flow compiles into
+* Parameters:
+*     flow - Flow to explain
+*     fp   - Where to print
+*/
+void Flow_explain(Flow *flow, FILE *fp);
+
+/**
+* Compute a flow. Every stage's map tasks run on the thread pool, and
+* each shuffle hands its partitions to the next stage in memory.
+* Parameters:
+*     flow        - Flow to compute
+*     sink        - Receives the records of the result (one call at a
+*                   time, in key order after Flow_sort_by_key), or NULL to
+*                   print them as "key: value" lines
+*     ctx         - Passed through to sink
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of partitions of every shuffle
+* Note: MR_Cancel stops the run after the running stage's tasks
+*/
+void Flow_run(Flow *flow, FlowSink sink, void *ctx,
+              unsigned int num_workers, unsigned int num_parts);
+
+#endif
@@ -0,0 +1,86 @@
+#include "mrhll.h"
+#include "mrtable.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+struct HyperLogLog {
+    unsigned int precision;
+    uint8_t *registers;  // 2^precision
+};
+
+// Create an empty estimator
+HyperLogLog *Hll_create(unsigned int precision) {
+    if (precision < 4) precision = 4;
+    if (precision > 18) precision = 18;
+    HyperLogLog *hll = malloc(sizeof(HyperLogLog));
+    if (!hll) return NULL;
+    hll->precision = precision;
+    hll->registers = calloc((size_t)1 << precision, 1);
+    if (!hll->registers) {
+        free(hll);
+        return NULL;
+    }
+    return hll;
+}
+
+// The hash tables' hash, with a finalizer spreading it over all 64 bits
+uint64_t Hll_hash(const char *key) {
+    uint64_t hash = Table_hash(key);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Add a key
+void Hll_add(HyperLogLog *hll, const char *key) {
+    Hll_add_hash(hll, Hll_hash(key));
+}
+
+// Add a hashed key: the top bits pick a register, which keeps the longest
+// run of leading zeros (plus one) seen in the rest
+void Hll_add_hash(HyperLogLog *hll, uint64_t hash) {
+    uint64_t rest = hash << hll->precision;
+    unsigned int rank = rest ? (unsigned int)__builtin_clzll(rest) + 1 : 64 - hll->precision + 1;
+    uint8_t *reg = &hll->registers[hash >> (64 - hll->precision)];
+    if (rank > *reg) *reg = (uint8_t)rank;
+}
+
+// Fold one estimator into another
+void Hll_merge(HyperLogLog *into, const HyperLogLog *from) {
+    size_t m = (size_t)1 << into->precision;
+    for (size_t i = 0; i < m; i++) {
+        if (from->registers[i] > into->registers[i]) into->registers[i] = from->registers[i];
+    }
+}
+
+// Estimate the number of distinct keys, with linear counting while many
+// registers are still empty
+double Hll_estimate(const HyperLogLog *hll) {
+    size_t m = (size_t)1 << hll->precision;
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < m; i++) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        if (hll->registers[i] == 0) zeros++;
+    }
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) estimate = m * log((double)m / zeros);
+    return estimate;
+}
+
+// Get the relative standard error
+double Hll_error(const HyperLogLog *hll) {
+    return 1.04 / sqrt((double)((size_t)1 << hll->precision));
+}
+
+// Free an estimator
+void Hll_free(HyperLogLog *hll) {
+    if (!hll) return;
+    free(hll->registers);
+    free(hll);
+}
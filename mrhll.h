@@ -0,0 +1,51 @@
+// HyperLogLog: estimates the number of distinct keys in a stream in a few
+// kilobytes, used by the sketches and the job estimator.
+#ifndef MRHLL_H
+#define MRHLL_H
+#include <stdint.h>
+
+typedef struct HyperLogLog HyperLogLog;
+
+/**
+* Create an empty estimator
+* Parameters:
+*     precision - Registers: 2^precision, from 4 to 18 (clamped); the
+*                 standard error is 1.04 / sqrt(registers)
+* Return:
+*     HyperLogLog* - Estimator, or NULL if out of memory
+*/
+HyperLogLog *Hll_create(unsigned int precision);
+
+/**
+* Hash a key with all 64 bits well mixed, as Hll_add_hash expects
+*/
+uint64_t Hll_hash(const char *key);
+
+/**
+* Add a key, or a key hashed with Hll_hash
+*/
+void Hll_add(HyperLogLog *hll, const char *key);
+void Hll_add_hash(HyperLogLog *hll, uint64_t hash);
+
+/**
+* Fold one estimator into another of the same precision, which then
+* counts the keys added to either
+*/
+void Hll_merge(HyperLogLog *into, const HyperLogLog *from);
+
+/**
+* Estimate the number of distinct keys added
+*/
+double Hll_estimate(const HyperLogLog *hll);
+
+/**
+* Get the standard error of the estimates, relative to them
+*/
+double Hll_error(const HyperLogLog *hll);
+
+/**
+* Free an estimator
+*/
+void Hll_free(HyperLogLog *hll);
+
+#endif
@@ -0,0 +1,785 @@
+#define _GNU_SOURCE
+#include "mrinput.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+#define HAVE_COMPRESSION
+#endif
+
+// Amount of decompressed data a single frame job aims to produce
+#define FRAME_JOB_BYTES (4u << 20)
+// Output buffer used by whole-file streaming decompression
+#define STREAM_BUF_BYTES (1u << 20)
+
+// A compressed frame (BGZF block or zstd frame) and where its output goes
+typedef struct {
+    size_t src_off;
+    size_t src_len;
+    size_t dst_off;
+    size_t dst_len;
+    uint32_t crc;  // expected CRC32 of the output (gzip only)
+} Frame;
+
+struct Pending;
+
+// A run of consecutive frames decompressed by one pool job
+typedef struct {
+    struct Pending *pending;
+    size_t first;
+    size_t count;
+} FrameJob;
+
+// Decompression state of one compressed input, freed by its last job
+typedef struct Pending {
+    InputFile *file;
+    const unsigned char *src;  // read-only mapping of the compressed file
+    size_t src_len;
+    unsigned char *dst;        // shared mapping of the memfd (frame jobs only)
+    size_t dst_len;
+    Frame *frames;
+    FrameJob *jobs;
+    atomic_uint remaining;     // jobs still running
+    InputReady_t ready;
+    void *ctx;
+} Pending;
+
+// Size of the line-aligned blocks pipe inputs are cut into
+static size_t block_size = INPUT_DEFAULT_BLOCK_BYTES;
+// Pipe blocks and decompressed inputs held in memory: handed out (or being
+// decompressed) but not yet released with Input_done
+static unsigned int held_inputs = 0;
+static pthread_mutex_t held_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t held_released = PTHREAD_COND_INITIALIZER;
+
+static uint32_t read_le16(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+    return read_le16(p) | (read_le16(p + 2) << 16);
+}
+
+static InputFormat detect_format(const unsigned char *p, size_t len) {
+    if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b) return INPUT_GZIP;
+    if (len >= 4 && read_le32(p) == 0xFD2FB528u) return INPUT_ZSTD;
+    return INPUT_PLAIN;
+}
+
+// Detect the format of a file from its first bytes
+InputFormat Input_format(const char *name) {
+    unsigned char magic[4];
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return INPUT_PLAIN;
+    ssize_t len = pread(fd, magic, sizeof(magic), 0);
+    close(fd);
+    return len > 0 ? detect_format(magic, (size_t)len) : INPUT_PLAIN;
+}
+
+static bool format_supported(InputFormat format) {
+    switch (format) {
+    case INPUT_PLAIN: return true;
+#ifdef HAVE_ZLIB
+    case INPUT_GZIP: return true;
+#endif
+#ifdef HAVE_ZSTD
+    case INPUT_ZSTD: return true;
+#endif
+    default: return false;
+    }
+}
+
+static bool write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+#ifdef HAVE_COMPRESSION
+
+// Append a frame to a growable array
+static bool push_frame(Frame **frames, size_t *n, size_t *cap, Frame f) {
+    if (*n == *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 64;
+        Frame *grown = realloc(*frames, new_cap * sizeof(Frame));
+        if (!grown) return false;
+        *frames = grown;
+        *cap = new_cap;
+    }
+    (*frames)[(*n)++] = f;
+    return true;
+}
+
+#ifdef HAVE_ZLIB
+// Index the blocks of a BGZF file: gzip members whose BC extra subfield
+// records the member size. Returns 0 unless the whole file is BGZF.
+static size_t bgzf_index(const unsigned char *p, size_t len, Frame **out) {
+    Frame *frames = NULL;
+    size_t n = 0, cap = 0, off = 0, dst = 0;
+
+    while (off < len) {
+        // BGZF members only ever set FEXTRA
+        if (len - off < 18 || p[off] != 0x1f || p[off + 1] != 0x8b ||
+            p[off + 2] != 8 || p[off + 3] != 4) goto fail;
+
+        size_t xlen = read_le16(p + off + 10);
+        size_t x = off + 12, xend = x + xlen, bsize = 0;
+        if (xend > len) goto fail;
+        while (x + 4 <= xend) {
+            size_t slen = read_le16(p + x + 2);
+            if (p[x] == 'B' && p[x + 1] == 'C' && slen == 2 && x + 6 <= xend) {
+                bsize = read_le16(p + x + 4) + 1;
+            }
+            x += 4 + slen;
+        }
+        if (bsize < 12 + xlen + 8 || bsize > len - off) goto fail;
+
+        Frame f;
+        f.src_off = off + 12 + xlen;
+        f.src_len = bsize - 12 - xlen - 8;
+        f.crc = read_le32(p + off + bsize - 8);
+        f.dst_off = dst;
+        f.dst_len = read_le32(p + off + bsize - 4);
+        if (!push_frame(&frames, &n, &cap, f)) goto fail;
+
+        dst += f.dst_len;
+        off += bsize;
+    }
+
+    *out = frames;
+    return n;
+
+fail:
+    free(frames);
+    return 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// Index the frames of a zstd file. Skippable frames (e.g. the seek table of
+// the seekable format) are left out. Returns 0 if any frame does not record
+// its decompressed size.
+static size_t zstd_index(const unsigned char *p, size_t len, Frame **out) {
+    Frame *frames = NULL;
+    size_t n = 0, cap = 0, off = 0, dst = 0;
+
+    while (off < len) {
+        if (len - off >= 8 && (read_le32(p + off) & 0xFFFFFFF0u) == 0x184D2A50u) {
+            size_t skip = 8 + (size_t)read_le32(p + off + 4);
+            if (skip > len - off) goto fail;
+            off += skip;
+            continue;
+        }
+
+        size_t csize = ZSTD_findFrameCompressedSize(p + off, len - off);
+        if (ZSTD_isError(csize)) goto fail;
+        unsigned long long dsize = ZSTD_getFrameContentSize(p + off, csize);
+        if (dsize == ZSTD_CONTENTSIZE_UNKNOWN || dsize == ZSTD_CONTENTSIZE_ERROR) goto fail;
+
+        Frame f = { off, csize, dst, (size_t)dsize, 0 };
+        if (!push_frame(&frames, &n, &cap, f)) goto fail;
+
+        dst += f.dst_len;
+        off += csize;
+    }
+
+    *out = frames;
+    return n;
+
+fail:
+    free(frames);
+    return 0;
+}
+#endif
+
+static size_t index_frames(InputFormat format, const unsigned char *p, size_t len, Frame **out) {
+    *out = NULL;
+    switch (format) {
+#ifdef HAVE_ZLIB
+    case INPUT_GZIP: return bgzf_index(p, len, out);
+#endif
+#ifdef HAVE_ZSTD
+    case INPUT_ZSTD: return zstd_index(p, len, out);
+#endif
+    default: return 0;
+    }
+}
+
+// Called by the last job of a compressed input: drop the mappings and hand
+// the decompressed data to the caller
+static void pending_finish(Pending *pending) {
+    if (atomic_fetch_sub(&pending->remaining, 1) != 1) return;
+
+    if (pending->dst) munmap(pending->dst, pending->dst_len);
+    munmap((void *)pending->src, pending->src_len);
+
+    InputFile *file = pending->file;
+    InputReady_t ready = pending->ready;
+    void *ctx = pending->ctx;
+    free(pending->frames);
+    free(pending->jobs);
+    free(pending);
+
+    ready(file, ctx);
+}
+
+// Decompress a run of frames straight into their slots in the memfd mapping
+static void frame_job(void *arg) {
+    FrameJob *job = (FrameJob *)arg;
+    Pending *pending = job->pending;
+    InputFormat format = pending->file->format;
+    bool ok = true;
+
+#ifdef HAVE_ZLIB
+    z_stream zs;
+    if (format == INPUT_GZIP) {
+        memset(&zs, 0, sizeof(zs));
+        ok = inflateInit2(&zs, -MAX_WBITS) == Z_OK;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *dctx = NULL;
+    if (format == INPUT_ZSTD) {
+        dctx = ZSTD_createDCtx();
+        ok = dctx != NULL;
+    }
+#endif
+
+    for (size_t i = job->first; ok && i < job->first + job->count; i++) {
+        Frame *f = &pending->frames[i];
+        const unsigned char *src = pending->src + f->src_off;
+        unsigned char *dst = pending->dst + f->dst_off;
+
+#ifdef HAVE_ZLIB
+        if (format == INPUT_GZIP) {
+            // BGZF blocks are at most 64KiB, well within zlib's uInt counters
+            inflateReset(&zs);
+            zs.next_in = (Bytef *)src;
+            zs.avail_in = (uInt)f->src_len;
+            zs.next_out = dst;
+            zs.avail_out = (uInt)f->dst_len;
+            ok = inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.avail_out == 0 &&
+                 crc32(0L, dst, (uInt)f->dst_len) == f->crc;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (format == INPUT_ZSTD) {
+            size_t got = ZSTD_decompressDCtx(dctx, dst, f->dst_len, src, f->src_len);
+            ok = !ZSTD_isError(got) && got == f->dst_len;
+        }
+#endif
+    }
+
+#ifdef HAVE_ZLIB
+    if (format == INPUT_GZIP) inflateEnd(&zs);
+#endif
+#ifdef HAVE_ZSTD
+    if (format == INPUT_ZSTD) ZSTD_freeDCtx(dctx);
+#endif
+
+    if (!ok) {
+        fprintf(stderr, "mrinput: %s: corrupt compressed data\n", pending->file->name);
+    }
+    pending_finish(pending);
+}
+
+#ifdef HAVE_ZLIB
+// zlib counts input in uInt, so feed huge files in slices
+static void gzip_refill(z_stream *zs, const unsigned char **src, size_t *len) {
+    if (zs->avail_in > 0 || *len == 0) return;
+    size_t chunk = *len < (1u << 30) ? *len : (1u << 30);
+    zs->next_in = (Bytef *)*src;
+    zs->avail_in = (uInt)chunk;
+    *src += chunk;
+    *len -= chunk;
+}
+
+// Inflate all gzip members of a file in order, writing to its memfd
+static bool gzip_stream(const unsigned char *src, size_t len, int fd, unsigned char *buf, size_t *written) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, MAX_WBITS + 16) != Z_OK) return false;
+
+    bool ok = false;
+    for (;;) {
+        gzip_refill(&zs, &src, &len);
+        zs.next_out = buf;
+        zs.avail_out = STREAM_BUF_BYTES;
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        size_t have = STREAM_BUF_BYTES - zs.avail_out;
+        if (!write_all(fd, buf, have)) break;
+        *written += have;
+
+        if (ret == Z_STREAM_END) {
+            gzip_refill(&zs, &src, &len);
+            // another member may follow; anything else is trailing padding
+            if (zs.avail_in == 0 || zs.next_in[0] != 0x1f) {
+                ok = true;
+                break;
+            }
+            inflateReset(&zs);
+        } else if (ret != Z_OK && !(ret == Z_BUF_ERROR && (zs.avail_in > 0 || len > 0))) {
+            break;
+        }
+    }
+
+    inflateEnd(&zs);
+    return ok;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+// Decompress all frames of a zstd file in order, writing to its memfd
+static bool zstd_stream(const unsigned char *src, size_t len, int fd, unsigned char *buf, size_t *written) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    if (!ds) return false;
+
+    ZSTD_inBuffer in = { src, len, 0 };
+    size_t ret = 0;
+    bool ok = true;
+    while (ok && in.pos < in.size) {
+        ZSTD_outBuffer out = { buf, STREAM_BUF_BYTES, 0 };
+        ret = ZSTD_decompressStream(ds, &out, &in);
+        ok = !ZSTD_isError(ret) && write_all(fd, buf, out.pos);
+        *written += out.pos;
+    }
+    // flush whatever the last frame still buffers
+    while (ok && ret != 0) {
+        ZSTD_outBuffer out = { buf, STREAM_BUF_BYTES, 0 };
+        ret = ZSTD_decompressStream(ds, &out, &in);
+        ok = !ZSTD_isError(ret) && out.pos > 0 && write_all(fd, buf, out.pos);
+        *written += out.pos;
+    }
+
+    ZSTD_freeDStream(ds);
+    return ok;
+}
+#endif
+
+// Decompress a file without a frame index on a single worker
+static void stream_job(void *arg) {
+    Pending *pending = (Pending *)arg;
+    InputFile *file = pending->file;
+    unsigned char *buf = malloc(STREAM_BUF_BYTES);
+    size_t written = 0;
+    bool ok = false;
+
+    if (buf) {
+#ifdef HAVE_ZLIB
+        if (file->format == INPUT_GZIP) {
+            ok = gzip_stream(pending->src, pending->src_len, file->fd, buf, &written);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (file->format == INPUT_ZSTD) {
+            ok = zstd_stream(pending->src, pending->src_len, file->fd, buf, &written);
+        }
+#endif
+    }
+    free(buf);
+
+    if (!ok) {
+        fprintf(stderr, "mrinput: %s: corrupt compressed data\n", file->name);
+    }
+    file->size = written;
+    pending_finish(pending);
+}
+
+// Size the memfd from the frame index and split the frames into jobs
+static bool submit_frame_jobs(ThreadPool_t *tp, Pending *pending, size_t nframes) {
+    Frame *last = &pending->frames[nframes - 1];
+    size_t total = last->dst_off + last->dst_len;
+    InputFile *file = pending->file;
+
+    if (ftruncate(file->fd, (off_t)total) != 0) return false;
+    file->size = total;
+    if (total == 0) {
+        // nothing to decompress (e.g. a lone BGZF EOF block)
+        atomic_store(&pending->remaining, 1);
+        pending_finish(pending);
+        return true;
+    }
+
+    pending->dst = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (pending->dst == MAP_FAILED) {
+        pending->dst = NULL;
+        return false;
+    }
+    pending->dst_len = total;
+
+    pending->jobs = malloc(nframes * sizeof(FrameJob));
+    if (!pending->jobs) {
+        munmap(pending->dst, total);
+        pending->dst = NULL;
+        return false;
+    }
+
+    // group frames so each job produces about FRAME_JOB_BYTES
+    size_t njobs = 0;
+    for (size_t i = 0; i < nframes; ) {
+        FrameJob *job = &pending->jobs[njobs++];
+        size_t bytes = 0;
+        job->pending = pending;
+        job->first = i;
+        job->count = 0;
+        while (i < nframes && (job->count == 0 || bytes < FRAME_JOB_BYTES)) {
+            bytes += pending->frames[i].dst_len;
+            job->count++;
+            i++;
+        }
+    }
+
+    // count every job before the first one can finish
+    atomic_store(&pending->remaining, (unsigned int)njobs);
+    for (size_t j = 0; j < njobs; j++) {
+        Frame *f = &pending->frames[pending->jobs[j].first + pending->jobs[j].count - 1];
+        size_t job_bytes = f->dst_off + f->dst_len - pending->frames[pending->jobs[j].first].dst_off;
+        if (!ThreadPool_add_job(tp, frame_job, &pending->jobs[j], job_bytes)) {
+            pending_finish(pending);
+        }
+    }
+    return true;
+}
+
+// Start decompressing one input; returns false if it should be read as-is
+static bool start_decompression(ThreadPool_t *tp, InputFile *file, const unsigned char *src,
+                                size_t len, InputReady_t ready, void *ctx) {
+    file->fd = memfd_create("mrinput", MFD_CLOEXEC);
+    if (file->fd < 0) return false;
+    snprintf(file->fd_path, sizeof(file->fd_path), "/proc/self/fd/%d", file->fd);
+
+    Pending *pending = calloc(1, sizeof(Pending));
+    if (!pending) goto fail;
+    pending->file = file;
+    pending->src = src;
+    pending->src_len = len;
+    pending->ready = ready;
+    pending->ctx = ctx;
+
+    // set before any job can finish and report the file ready
+    file->path = file->fd_path;
+    size_t nframes = index_frames(file->format, src, len, &pending->frames);
+    if (nframes > 0 && submit_frame_jobs(tp, pending, nframes)) return true;
+
+    // no usable frame index: decompress the whole file on one worker, sized
+    // by its compressed length until the real size is known
+    free(pending->frames);
+    pending->frames = NULL;
+    atomic_store(&pending->remaining, 1);
+    if (ThreadPool_add_job(tp, stream_job, pending, len)) return true;
+    file->path = file->name;
+    free(pending);
+
+fail:
+    close(file->fd);
+    file->fd = -1;
+    return false;
+}
+#endif
+
+// Wait until fewer than 2 inputs per worker are held in memory, so that
+// reading and decompression stay only a little ahead of the map tasks
+static void wait_for_room(ThreadPool_t *tp) {
+    pthread_mutex_lock(&held_lock);
+    while (held_inputs >= 2 * tp->num_threads) {
+        pthread_cond_wait(&held_released, &held_lock);
+    }
+    pthread_mutex_unlock(&held_lock);
+}
+
+static void hold_input(void) {
+    pthread_mutex_lock(&held_lock);
+    held_inputs++;
+    pthread_mutex_unlock(&held_lock);
+}
+
+static void release_input(void) {
+    pthread_mutex_lock(&held_lock);
+    held_inputs--;
+    pthread_cond_signal(&held_released);
+    pthread_mutex_unlock(&held_lock);
+}
+
+// Copy a block of data into a memfd and hand it out
+static void make_block(const char *name, unsigned int index, const char *data, size_t len,
+                       InputReady_t ready, void *ctx) {
+    InputFile *block = calloc(1, sizeof(InputFile));
+    int fd = memfd_create("mrinput-block", MFD_CLOEXEC);
+    if (!block || fd < 0 || !write_all(fd, (const unsigned char *)data, len)) {
+        fprintf(stderr, "mrinput: %s: dropped a %zu byte block\n", name, len);
+        if (fd >= 0) close(fd);
+        free(block);
+        return;
+    }
+
+    hold_input();
+
+    block->name = (char *)name;
+    block->index = index;
+    block->fd = fd;
+    snprintf(block->fd_path, sizeof(block->fd_path), "/proc/self/fd/%d", fd);
+    block->path = block->fd_path;
+    block->format = INPUT_PIPE;
+    block->size = len;
+    block->block = true;
+    ready(block, ctx);
+}
+
+// Hand out one line-aligned block of a pipe, waiting first if too many
+// inputs are still being mapped (unless the caller holds them all)
+static void emit_block(ThreadPool_t *tp, InputFile *pipe, const char *data, size_t len,
+                       bool bounded, InputReady_t ready, void *ctx) {
+    if (bounded) wait_for_room(tp);
+    make_block(pipe->name, pipe->index, data, len, ready, ctx);
+}
+
+// Read a pipe to its end, cutting it into blocks at line boundaries
+static void read_pipe(ThreadPool_t *tp, InputFile *pipe, int fd, bool bounded,
+                      InputReady_t ready, void *ctx) {
+    size_t cap = block_size, len = 0;
+    char *buf = malloc(cap);
+    bool eof = buf == NULL;
+
+    for (;;) {
+        while (!eof && len < cap) {
+            ssize_t n = read(fd, buf + len, cap - len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n < 0) perror(pipe->name);
+                eof = true;
+                break;
+            }
+            len += (size_t)n;
+            pipe->size += (size_t)n;
+        }
+        if (len == 0) break;
+
+        // cut after the last complete line; the final block takes the rest
+        size_t cut = len;
+        if (!eof) {
+            char *nl = memrchr(buf, '\n', len);
+            if (!nl) {
+                // a line longer than the buffer: grow it and keep reading
+                char *grown = realloc(buf, cap * 2);
+                if (grown) {
+                    buf = grown;
+                    cap *= 2;
+                    continue;
+                }
+            } else {
+                cut = (size_t)(nl - buf) + 1;
+            }
+        }
+
+        emit_block(tp, pipe, buf, cut, bounded, ready, ctx);
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+    }
+
+    free(buf);
+}
+
+// Pipes are read by the framework rather than opened by the mapper
+static bool is_pipe(const char *name, struct stat *st) {
+    if (strcmp(name, "-") == 0) return true;
+    return S_ISFIFO(st->st_mode) || S_ISCHR(st->st_mode) || S_ISSOCK(st->st_mode);
+}
+
+// Detect and prepare all inputs, holding at most 2 per worker in memory
+// at a time if bounded
+static void prepare(ThreadPool_t *tp, unsigned int count, char *names[], InputFile *files,
+                    bool bounded, InputReady_t ready, void *ctx) {
+    for (unsigned int i = 0; i < count; i++) {
+        InputFile *file = &files[i];
+        file->name = names[i];
+        file->path = names[i];
+        file->format = INPUT_PLAIN;
+        file->fd = -1;
+        file->size = 0;
+        file->index = i;
+        file->block = false;
+
+        struct stat st;
+        if (stat(names[i], &st) != 0) {
+            if (strcmp(names[i], "-") == 0) {
+                file->format = INPUT_PIPE;
+            } else {
+                ready(file, ctx);
+            }
+            continue;
+        }
+        if (is_pipe(names[i], &st)) {
+            // read once the regular files are queued, as pipes block
+            file->format = INPUT_PIPE;
+            continue;
+        }
+        file->size = (size_t)st.st_size;
+
+        int fd = S_ISREG(st.st_mode) && st.st_size > 0 ? open(names[i], O_RDONLY) : -1;
+        if (fd < 0) {
+            ready(file, ctx);
+            continue;
+        }
+        unsigned char *src = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (src == MAP_FAILED) {
+            ready(file, ctx);
+            continue;
+        }
+
+        file->format = detect_format(src, file->size);
+        if (!format_supported(file->format)) {
+            fprintf(stderr, "mrinput: %s: compression format not supported by this build\n", names[i]);
+            file->format = INPUT_PLAIN;
+        }
+#ifdef HAVE_COMPRESSION
+        if (file->format != INPUT_PLAIN) {
+            // the decompressed data is held until the map task is done
+            if (bounded) wait_for_room(tp);
+            hold_input();
+            if (start_decompression(tp, file, src, file->size, ready, ctx)) continue;
+            release_input();
+        }
+#endif
+        munmap(src, file->size);
+        ready(file, ctx);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        InputFile *file = &files[i];
+        if (file->format != INPUT_PIPE) continue;
+
+        bool is_stdin = strcmp(file->name, "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(file->name, O_RDONLY);
+        if (fd < 0) {
+            perror(file->name);
+            continue;
+        }
+        read_pipe(tp, file, fd, bounded, ready, ctx);
+        if (!is_stdin) close(fd);
+    }
+}
+
+void Input_prepare(ThreadPool_t *tp, unsigned int count, char *names[],
+                   InputFile *files, InputReady_t ready, void *ctx) {
+    prepare(tp, count, names, files, true, ready, ctx);
+}
+
+void Input_prepare_all(ThreadPool_t *tp, unsigned int count, char *names[],
+                       InputFile *files, InputReady_t ready, void *ctx) {
+    prepare(tp, count, names, files, false, ready, ctx);
+}
+
+// Release a pipe block or the data of a decompressed input once its map
+// job is done with it
+void Input_done(InputFile *file) {
+    if (file->fd < 0) return;
+    close(file->fd);
+    file->fd = -1;
+    if (file->block) free(file);
+    release_input();
+}
+
+// Copy the first lines of a plain file into a block
+bool Input_sample(const char *name, off_t offset, size_t bytes, InputFile *block) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    unsigned char magic[4];
+    char *buf = NULL;
+    ssize_t len = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 &&
+        (size_t)st.st_size > (size_t)offset + bytes &&
+        pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+        detect_format(magic, sizeof(magic)) == INPUT_PLAIN && (buf = malloc(bytes)) != NULL) {
+        len = pread(fd, buf, bytes, offset);
+    }
+    close(fd);
+
+    // whole lines only: from the first line that starts in the range to
+    // the last one that ends in it
+    size_t skip = 0, used = len > 0 ? (size_t)len : 0;
+    if (offset > 0 && used > 0) {
+        const char *nl = memchr(buf, '\n', used);
+        skip = nl ? (size_t)(nl - buf) + 1 : used;
+    }
+    while (used > skip && buf[used - 1] != '\n') used--;
+    used -= skip;
+    int block_fd = used > 0 ? memfd_create("mrinput-sample", MFD_CLOEXEC) : -1;
+    bool ok = block_fd >= 0 && write_all(block_fd, (const unsigned char *)buf + skip, used);
+    free(buf);
+    if (!ok) {
+        if (block_fd >= 0) close(block_fd);
+        return false;
+    }
+
+    hold_input();
+    block->name = (char *)name;
+    block->index = 0;
+    block->fd = block_fd;
+    snprintf(block->fd_path, sizeof(block->fd_path), "/proc/self/fd/%d", block_fd);
+    block->path = block->fd_path;
+    block->format = INPUT_PLAIN;
+    block->size = used;
+    block->block = false;
+    return true;
+}
+
+// Cut data into line-aligned blocks and hand them out
+size_t Input_split_blocks(const char *name, unsigned int index, const char *data, size_t len, bool final,
+                          InputReady_t ready, void *ctx) {
+    size_t used = 0;
+    while (used < len) {
+        size_t rest = len - used;
+        size_t cut = rest;
+        if (rest > block_size || !final) {
+            // end the block after the last newline that fits, or after the
+            // first one if a single line is longer than a block
+            size_t span = rest > block_size ? block_size : rest;
+            const char *nl = memrchr(data + used, '\n', span);
+            if (!nl) nl = memchr(data + used + span, '\n', rest - span);
+            if (!nl) {
+                if (!final) break;
+            } else {
+                cut = (size_t)(nl - (data + used)) + 1;
+            }
+        }
+        make_block(name, index, data + used, cut, ready, ctx);
+        used += cut;
+    }
+    return used;
+}
+
+// Close the memfds backing decompressed inputs not yet released
+void Input_release(InputFile *files, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        Input_done(&files[i]);
+    }
+}
+
+// Set the block size used to cut pipe inputs
+void Input_set_block_size(size_t bytes) {
+    if (bytes > 0) block_size = bytes;
+}
@@ -0,0 +1,130 @@
+// Input layer used by MR_Run to turn the file names it is given into
+// readable map splits.
+#ifndef MRINPUT_H
+#define MRINPUT_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "threadpool.h"
+
+// Default size of the blocks pipe inputs are cut into
+#define INPUT_DEFAULT_BLOCK_BYTES (4u << 20)
+
+// Formats recognized by the input layer
+typedef enum {
+    INPUT_PLAIN,  // handed to the mapper as-is
+    INPUT_GZIP,   // gzip, single or multi-member (BGZF blocks decompress in parallel)
+    INPUT_ZSTD,   // zstd frames (only when built with HAVE_ZSTD)
+    INPUT_PIPE    // stdin ("-"), FIFO or other stream, read in line-aligned blocks
+} InputFormat;
+
+typedef struct {
+    char *name;          // file name passed to MR_Run
+    char *path;          // path the mapper should open
+    char fd_path[32];    // storage for path when it refers to fd
+    InputFormat format;  // detected format of name
+    int fd;              // memfd holding decompressed data (-1 for plain files)
+    size_t size;         // bytes the mapper will read (used for scheduling)
+    unsigned int index;  // position in the names array (of the pipe, for blocks)
+    bool block;          // a block of a pipe input, released by Input_done
+} InputFile;
+
+// Callback invoked once an input is ready to be mapped
+typedef void (*InputReady_t)(InputFile *file, void *ctx);
+
+/**
+* Detect the format of each input and decompress the compressed ones into
+* anonymous memory files using the workers of the given pool. At most 2
+* pipe blocks and decompressed inputs per worker are held in memory: once
+* that many are, reading waits for the map tasks to release one with
+* Input_done, so inputs are read only a little ahead of the map tasks.
+* Parameters:
+*     tp    - Pointer to the ThreadPool object that runs decompression jobs
+*     count - Number of input files
+*     names - Array of file names
+*     files - Array of count InputFile objects to fill in
+*     ready - Called for each file once its data can be read through path
+*     ctx   - Passed through to ready
+* Note: ready is called from the calling thread for plain files and from a
+*       pool worker for compressed ones; use ThreadPool_check to wait for all.
+*       Pipes are read after the other inputs are queued and handed to ready
+*       one block at a time, each block being a separate InputFile. Every
+*       input handed to ready must be released with Input_done.
+*/
+void Input_prepare(ThreadPool_t *tp, unsigned int count, char *names[],
+                   InputFile *files, InputReady_t ready, void *ctx);
+
+/**
+* Prepare inputs as Input_prepare does, for callers that hold every input
+* until Input_release (e.g. to hand them all to worker processes): nothing
+* waits for inputs to be released, so all of them may be in memory at once
+*/
+void Input_prepare_all(ThreadPool_t *tp, unsigned int count, char *names[],
+                       InputFile *files, InputReady_t ready, void *ctx);
+
+/**
+* Signal that the mapper is done with an input handed to the ready callback,
+* freeing a pipe block or the decompressed data of an input
+* Parameters:
+*     file - InputFile passed to ready
+* Note: reading waits for inputs to be released once 2 per worker are held
+*/
+void Input_done(InputFile *file);
+
+/**
+* Detect the format of a file from its first bytes
+* Parameters:
+*     name - Name of the file
+* Return:
+*     InputFormat - Format of the file (INPUT_PLAIN if it cannot be read)
+*/
+InputFormat Input_format(const char *name);
+
+/**
+* Copy the lines of a byte range of an uncompressed regular file into a
+* block the mapper can read, so that callers can sample what it emits
+* Parameters:
+*     name   - Name of the file
+*     offset - Start of the range; past 0, the line it cuts is skipped
+*     bytes  - Length of the range; the block ends at its last newline
+*     block  - Filled in with the block, released with Input_done
+* Return:
+*     true  - On success
+*     false - If the file is not a plain regular file that extends past
+*             the range, or the range holds no whole line
+*/
+bool Input_sample(const char *name, off_t offset, size_t bytes, InputFile *block);
+
+/**
+* Release the resources held by prepared inputs
+* Parameters:
+*     files - Array of InputFile objects filled in by Input_prepare
+*     count - Number of input files
+*/
+void Input_release(InputFile *files, unsigned int count);
+
+/**
+* Cut data into line-aligned blocks of at most the block size (unless a
+* single line is longer) and hand each block out as a separate InputFile
+* Parameters:
+*     name  - Name of the input the data comes from
+*     index - Index of that input, copied to the blocks
+*     data  - Data to split; copied, so it can be reused once this returns
+*     len   - Number of bytes in data
+*     final - Whether data ends its input, so a trailing partial line is
+*             handed out instead of being left over
+*     ready - Called for each block; the block is released with Input_done
+*     ctx   - Passed through to ready
+* Return:
+*     size_t - Number of bytes handed out; the rest is a partial line
+*/
+size_t Input_split_blocks(const char *name, unsigned int index, const char *data, size_t len, bool final,
+                          InputReady_t ready, void *ctx);
+
+/**
+* Set the size of the blocks pipe inputs are cut into
+* Parameters:
+*     bytes - Block size; blocks end at the last newline before this size
+*/
+void Input_set_block_size(size_t bytes);
+
+#endif
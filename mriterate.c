@@ -0,0 +1,240 @@
+#include "mriterate.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "mrtable.h"
+#include "threadpool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_INITIAL_BUCKETS 1024
+
+// Static records and state of one key
+typedef struct IterEntry {
+    char *key;
+    char **values;
+    size_t count;
+    size_t cap;
+    char *state;  // NULL until a reducer reports one
+    struct IterEntry *next;
+} IterEntry;
+
+// Hash table holding the keys of one partition
+typedef struct {
+    IterEntry **buckets;
+    size_t nbuckets;
+    size_t count;
+    size_t changed;        // keys whose state the current iteration changed
+    pthread_mutex_t lock;  // taken while loading, when mappers run in parallel
+} IterTable;
+
+// Global variables
+static IterTable *tables = NULL;
+static IterMapper iter_mapper = NULL;
+
+static bool table_init(IterTable *table) {
+    table->nbuckets = TABLE_INITIAL_BUCKETS;
+    table->buckets = calloc(table->nbuckets, sizeof(IterEntry *));
+    if (!table->buckets) return false;
+    table->count = 0;
+    table->changed = 0;
+    pthread_mutex_init(&table->lock, NULL);
+    return true;
+}
+
+static void table_grow(IterTable *table) {
+    size_t nbuckets = table->nbuckets * 2;
+    IterEntry **buckets = calloc(nbuckets, sizeof(IterEntry *));
+    if (!buckets) return;
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        IterEntry *e = table->buckets[i];
+        while (e) {
+            IterEntry *next = e->next;
+            size_t b = Table_hash(e->key) & (nbuckets - 1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->nbuckets = nbuckets;
+}
+
+// Find the entry of key, creating it if needed
+static IterEntry *table_get(IterTable *table, const char *key) {
+    size_t b = Table_hash(key) & (table->nbuckets - 1);
+    for (IterEntry *e = table->buckets[b]; e; e = e->next) {
+        if (strcmp(e->key, key) == 0) return e;
+    }
+
+    IterEntry *e = calloc(1, sizeof(IterEntry));
+    if (!e) return NULL;
+    e->key = strdup(key);
+    if (!e->key) {
+        free(e);
+        return NULL;
+    }
+    e->next = table->buckets[b];
+    table->buckets[b] = e;
+    if (++table->count > table->nbuckets) table_grow(table);
+    return e;
+}
+
+static void table_destroy(IterTable *table) {
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        IterEntry *e = table->buckets[i];
+        while (e) {
+            IterEntry *next = e->next;
+            for (size_t v = 0; v < e->count; v++) {
+                free(e->values[v]);
+            }
+            free(e->values);
+            free(e->state);
+            free(e->key);
+            free(e);
+            e = next;
+        }
+    }
+    free(table->buckets);
+    pthread_mutex_destroy(&table->lock);
+}
+
+// MR_Emit target while loading: add a static record to its partition
+static void load_emit(char *key, char *value, unsigned int partition_idx) {
+    IterTable *table = &tables[partition_idx];
+    pthread_mutex_lock(&table->lock);
+    IterEntry *e = table_get(table, key);
+    if (e && e->count == e->cap) {
+        size_t cap = e->cap ? e->cap * 2 : 4;
+        char **grown = realloc(e->values, cap * sizeof(char *));
+        if (grown) {
+            e->values = grown;
+            e->cap = cap;
+        }
+    }
+    if (e && e->count < e->cap) e->values[e->count++] = strdup(value);
+    pthread_mutex_unlock(&table->lock);
+}
+
+// MR_Output target while iterating: set the new state of a key (each
+// partition is reduced by a single job, so its table needs no lock)
+static void iter_output(char *key, char *value, unsigned int partition_idx) {
+    IterTable *table = &tables[partition_idx];
+    IterEntry *e = table_get(table, key);
+    if (!e) return;
+    if (e->state && strcmp(e->state, value) == 0) return;
+    free(e->state);
+    e->state = strdup(value);
+    table->changed++;
+}
+
+// Map job of an iteration: run the mapper over every key of a partition
+static void iterate_partition_job(void *arg) {
+    IterTable *table = (IterTable *)arg;
+    for (size_t b = 0; b < table->nbuckets && !MR_Cancelled(); b++) {
+        for (IterEntry *e = table->buckets[b]; e; e = e->next) {
+            iter_mapper(e->key, e->values, e->count, e->state);
+        }
+    }
+}
+
+// Write the state of the keys of a partition to its result file
+static void write_partition_job(void *arg) {
+    unsigned int idx = (unsigned int)(size_t)arg;
+    IterTable *table = &tables[idx];
+    FILE *fp = NULL;
+    for (size_t b = 0; b < table->nbuckets; b++) {
+        for (IterEntry *e = table->buckets[b]; e; e = e->next) {
+            if (!e->state) continue;
+            if (!fp) {
+                char name[32];
+                snprintf(name, sizeof(name), "result-%u.txt", idx);
+                fp = fopen(name, "w");
+                if (!fp) return;
+            }
+            fprintf(fp, "%s: %s\n", e->key, e->state);
+        }
+    }
+    if (fp) fclose(fp);
+}
+
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
+}
+
+// Main iterative execution function
+void MR_RunIterative(unsigned int file_count, char *file_names[], Mapper loader,
+                     const IterConfig *config, unsigned int num_workers,
+                     unsigned int num_parts) {
+    if (num_parts == 0) return;
+    tables = malloc(num_parts * sizeof(IterTable));
+    if (!tables) return;
+    for (unsigned int i = 0; i < num_parts; i++) {
+        if (table_init(&tables[i])) continue;
+        while (i-- > 0) table_destroy(&tables[i]);
+        free(tables);
+        tables = NULL;
+        return;
+    }
+    iter_mapper = config->mapper;
+
+    Core_init(loader, num_parts);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    // Load Phase: the static records go straight to the tables of their
+    // partitions, once
+    Core_set_emit(load_emit);
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    if (files) {
+        Input_prepare(pool, file_count, file_names, files, submit_map_job, pool);
+        Core_wait(pool);
+        Input_release(files, file_count);
+        free(files);
+    } else {
+        // iterating over no static records would be wrong, not just slow
+        MR_Cancel();
+    }
+    Core_set_emit(NULL);
+
+    // Iterations: map every partition's keys, shuffle the messages and
+    // reduce them into the state
+    Core_set_output(iter_output);
+    for (unsigned int it = 1; it <= config->max_iterations && !MR_Cancelled(); it++) {
+        for (unsigned int i = 0; i < num_parts; i++) {
+            tables[i].changed = 0;
+            Core_add_task(pool, iterate_partition_job, &tables[i], tables[i].count);
+        }
+        Core_wait(pool);
+        Core_reduce(pool, config->reducer);
+
+        size_t changed = 0;
+        for (unsigned int i = 0; i < num_parts; i++) {
+            changed += tables[i].changed;
+        }
+        bool done = config->converged ? config->converged(it, changed, config->ctx)
+                                      : changed == 0;
+        if (done) break;
+    }
+    Core_set_output(NULL);
+
+    // Write the final state
+    if (!MR_Cancelled()) {
+        for (unsigned int i = 0; i < num_parts; i++) {
+            Core_add_task(pool, write_partition_job, (void *)(size_t)i, tables[i].count);
+        }
+        Core_wait(pool);
+    }
+
+    ThreadPool_destroy(pool);
+    Core_finish();
+    for (unsigned int i = 0; i < num_parts; i++) {
+        table_destroy(&tables[i]);
+    }
+    free(tables);
+    tables = NULL;
+    iter_mapper = NULL;
+}
@@ -0,0 +1,67 @@
+// Iterative jobs: a static dataset is loaded and partitioned once, and each
+// iteration only shuffles the messages its mapper emits, which update a
+// per-key state kept in the same partitions as the static records.
+#ifndef MRITERATE_H
+#define MRITERATE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "mapreduce.h"
+
+/**
+* Map one key of the static dataset in an iteration, emitting messages to
+* other keys with MR_Emit
+* Parameters:
+*     key    - Key of the static records
+*     values - Values the loader emitted for key, in no particular order
+*     count  - Number of values (0 for a key that only has state)
+*     state  - State of key after the previous iteration, or NULL if no
+*              reducer has reported one yet
+*/
+typedef void (*IterMapper)(const char *key, char *const *values, size_t count,
+                           const char *state);
+
+/**
+* Decide whether to stop after an iteration
+* Parameters:
+*     iteration - Iterations run so far (1 after the first)
+*     changed   - Keys whose state the iteration changed
+*     ctx       - ctx from the IterConfig
+* Return:
+*     true  - To stop
+*     false - To run another iteration
+*/
+typedef bool (*IterConverged)(unsigned int iteration, size_t changed, void *ctx);
+
+typedef struct {
+    IterMapper mapper;         // maps the static records and state of a key
+    Reducer reducer;           // sets a key's new state with MR_Output
+    unsigned int max_iterations;
+    IterConverged converged;   // NULL: stop once no state changes
+    void *ctx;                 // passed through to converged
+} IterConfig;
+
+/**
+* Run an iterative job. The loader maps the input files once, and the
+* records it emits are kept in memory, partitioned with MR_Partitioner.
+* Each iteration then runs a map task per partition, calling the mapper on
+* every key with its static records and state; the messages it emits are
+* shuffled and reduced as in MR_Run, and the result the reducer writes for
+* a key with MR_Output becomes the key's state. Because the state lives in
+* the partition of its key, only the messages move between partitions.
+* After the last iteration the state of every key is written to
+* result-<partition>.txt as "key: state" lines.
+* Parameters:
+*     file_count  - Number of input files of the static dataset
+*     file_names  - Array of input file names
+*     loader      - Map function that emits the static records
+*     config      - Iteration functions and stopping rule
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of partitions
+* Note: keys that receive no message keep their state; MR_Cancel stops
+*       after the running iteration's tasks
+*/
+void MR_RunIterative(unsigned int file_count, char *file_names[], Mapper loader,
+                     const IterConfig *config, unsigned int num_workers,
+                     unsigned int num_parts);
+
+#endif
@@ -0,0 +1,68 @@
+#include "mrjoin.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+#include <stdlib.h>
+
+// Global variables
+static const JoinInput *join_inputs = NULL;
+static unsigned int current_input = 0;  // input being mapped
+static Reducer join_reducer = NULL;
+
+// Map function of every input: tag the records with the input
+static void join_map(char *file_name) {
+    Core_set_tag(current_input);
+    join_inputs[current_input].mapper(file_name);
+    Core_set_tag(0);
+}
+
+// Reduce function: drop the values the reducer left, or the key would be
+// reduced again
+static void join_reduce(char *key, unsigned int partition_idx) {
+    join_reducer(key, partition_idx);
+    char *value;
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        free(value);
+    }
+}
+
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
+}
+
+// Get the next value of a key from one input
+char *MR_GetNextFrom(char *key, unsigned int partition_idx, unsigned int input) {
+    return Core_next_tagged(key, partition_idx, input);
+}
+
+// Main join execution function
+void MR_RunJoin(const JoinInput *inputs, unsigned int input_count, Reducer reducer,
+                unsigned int num_workers, unsigned int num_parts) {
+    if (input_count == 0 || input_count > JOIN_MAX_INPUTS) return;
+    join_inputs = inputs;
+    join_reducer = reducer;
+    Core_init(join_map, num_parts);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    // Map Phase: one input at a time, so that every map task knows its tag
+    for (unsigned int i = 0; i < input_count && !MR_Cancelled(); i++) {
+        current_input = i;
+        InputFile *files = malloc((inputs[i].file_count + 1) * sizeof(InputFile));
+        if (!files) continue;
+        Input_prepare(pool, inputs[i].file_count, inputs[i].file_names, files,
+                      submit_map_job, pool);
+        Core_wait(pool);
+        Input_release(files, inputs[i].file_count);
+        free(files);
+    }
+
+    // Reduce Phase
+    Core_reduce(pool, join_reduce);
+
+    ThreadPool_destroy(pool);
+    Core_finish();
+    join_inputs = NULL;
+    join_reducer = NULL;
+}
@@ -0,0 +1,49 @@
+// Reduce-side joins: several inputs, each with its own mapper, are
+// shuffled together with every record tagged by its input, and the values
+// of a key reach the reducer grouped by input.
+#ifndef MRJOIN_H
+#define MRJOIN_H
+#include "mapreduce.h"
+
+// Most inputs a join can take
+#define JOIN_MAX_INPUTS 256
+
+// One input of a join; its position in the inputs array is its tag
+typedef struct {
+    unsigned int file_count;
+    char **file_names;
+    Mapper mapper;  // emits the input's records with MR_Emit
+} JoinInput;
+
+/**
+* Run a join. The inputs are mapped one after another into the same
+* partitions, and within each key the shuffle orders the values by input,
+* so the reducer can buffer the values of the first input (the smaller
+* side) with MR_GetNextFrom(key, idx, 0) and stream those of the next
+* with MR_GetNextFrom(key, idx, 1), never holding both. Results are
+* written with MR_Output, as in MR_Run.
+* Parameters:
+*     inputs      - Inputs, in tag order (at most JOIN_MAX_INPUTS)
+*     input_count - Number of inputs
+*     reducer     - Reduce function; values it leaves unread are dropped
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of partitions to be created
+*/
+void MR_RunJoin(const JoinInput *inputs, unsigned int input_count, Reducer reducer,
+                unsigned int num_workers, unsigned int num_parts);
+
+/**
+* Get the next value of a key from one input of a join. Values arrive in
+* input order, so asking for a later input drops the unread values of the
+* earlier ones.
+* Parameters:
+*     key           - Key of the values being reduced
+*     partition_idx - Index of the partition containing this key
+*     input         - Tag of the input
+* Return:
+*     char * - Value (freed by the caller, as with MR_GetNext)
+*     NULL   - If the input has no more values for the key
+*/
+char *MR_GetNextFrom(char *key, unsigned int partition_idx, unsigned int input);
+
+#endif
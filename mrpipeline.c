@@ -0,0 +1,149 @@
+#include "mrpipeline.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_INITIAL_BYTES 4096
+
+// Results of one partition of a stage, packed as key, NUL, value, NUL
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    FILE *copy;  // materialized copy, opened on the first result
+} StageOutput;
+
+// Global variables
+static StageOutput *outputs = NULL;  // of the stage being reduced
+static const char *materialize = NULL;
+static RecordMapper record_mapper = NULL;
+
+// MR_Output target of every stage but the last: keep the result for the
+// next stage (each partition is reduced by a single job, so its output
+// needs no lock)
+static void pipeline_output(char *key, char *value, unsigned int partition_idx) {
+    StageOutput *out = &outputs[partition_idx];
+    size_t klen = strlen(key) + 1, vlen = strlen(value) + 1;
+    if (out->len + klen + vlen > out->cap) {
+        size_t cap = out->cap ? out->cap : OUTPUT_INITIAL_BYTES;
+        while (cap < out->len + klen + vlen) cap *= 2;
+        char *grown = realloc(out->data, cap);
+        if (!grown) {
+            // out of memory: the next stage would run on incomplete results
+            MR_Cancel();
+            return;
+        }
+        out->data = grown;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, key, klen);
+    memcpy(out->data + out->len + klen, value, vlen);
+    out->len += klen + vlen;
+
+    if (!materialize) return;
+    if (!out->copy) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s-%u.txt", materialize, partition_idx);
+        out->copy = fopen(name, "w");
+        if (!out->copy) return;
+    }
+    fprintf(out->copy, "%s: %s\n", key, value);
+}
+
+// Map job of a later stage: run the record mapper over the results of one
+// partition of the stage before
+static void map_partition_job(void *arg) {
+    StageOutput *in = (StageOutput *)arg;
+    char *pos = in->data, *end = in->data + in->len;
+    while (pos < end && !MR_Cancelled()) {
+        char *key = pos;
+        char *value = key + strlen(key) + 1;
+        // find the next record before the mapper gets to modify this one
+        pos = value + strlen(value) + 1;
+        record_mapper(key, value);
+    }
+}
+
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
+}
+
+static void outputs_free(StageOutput *outs, unsigned int count) {
+    for (unsigned int i = 0; outs && i < count; i++) {
+        if (outs[i].copy) fclose(outs[i].copy);
+        free(outs[i].data);
+    }
+    free(outs);
+}
+
+// Main pipeline execution function
+void MR_RunPipeline(unsigned int file_count, char *file_names[], Mapper mapper,
+                    const PipelineStage *stages, unsigned int stage_count,
+                    unsigned int num_workers) {
+    if (stage_count == 0) return;
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+    StageOutput *prev = NULL;  // results of the stage before
+    unsigned int prev_parts = 0;
+
+    for (unsigned int s = 0; s < stage_count; s++) {
+        const PipelineStage *stage = &stages[s];
+        bool last = s + 1 == stage_count;
+        Core_init(mapper, stage->num_parts);
+
+        // Map Phase: the input files, or the partitions of the stage before
+        if (s == 0) {
+            InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+            if (files) {
+                Input_prepare(pool, file_count, file_names, files, submit_map_job, pool);
+                Core_wait(pool);
+                Input_release(files, file_count);
+                free(files);
+            } else {
+                MR_Cancel();
+            }
+        } else {
+            record_mapper = stage->mapper;
+            for (unsigned int p = 0; p < prev_parts; p++) {
+                Core_add_task(pool, map_partition_job, &prev[p], prev[p].len);
+            }
+            Core_wait(pool);
+            outputs_free(prev, prev_parts);
+        }
+        prev = NULL;
+
+        // Reduce Phase: the last stage writes the result files, the others
+        // hand their results to the next stage
+        if (!last) {
+            outputs = calloc(stage->num_parts + 1, sizeof(StageOutput));
+            materialize = stage->materialize;
+            if (outputs) {
+                Core_set_output(pipeline_output);
+            } else {
+                // the reducers are not run, so nothing reaches the files
+                MR_Cancel();
+            }
+        }
+        Core_reduce(pool, stage->reducer);
+        Core_finish();
+
+        prev = outputs;
+        prev_parts = stage->num_parts;
+        outputs = NULL;
+        for (unsigned int p = 0; prev && p < prev_parts; p++) {
+            if (prev[p].copy) fclose(prev[p].copy);
+            prev[p].copy = NULL;
+        }
+        // a new stage would clear the cancellation
+        if (MR_Cancelled()) break;
+    }
+
+    outputs_free(prev, prev_parts);
+    materialize = NULL;
+    record_mapper = NULL;
+    ThreadPool_destroy(pool);
+}
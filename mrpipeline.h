@@ -0,0 +1,46 @@
+// Multi-stage pipelines: the results each stage's reducer writes with
+// MR_Output are handed to the next stage's mapper in memory, partition by
+// partition, instead of going through result files.
+#ifndef MRPIPELINE_H
+#define MRPIPELINE_H
+#include <stdbool.h>
+#include "mapreduce.h"
+
+/**
+* Map one result of the previous stage
+* Parameters:
+*     key   - Key the previous stage's reducer passed to MR_Output
+*     value - Its result (both may be modified, and are only valid for
+*             the duration of the call; MR_Emit copies what it keeps)
+*/
+typedef void (*RecordMapper)(char *key, char *value);
+
+typedef struct {
+    RecordMapper mapper;      // maps the previous stage's results (unused by the first stage)
+    Reducer reducer;          // reports the stage's results with MR_Output
+    unsigned int num_parts;   // partitions of the stage
+    const char *materialize;  // if set (on any stage but the last), also write
+                              // the results to <materialize>-<partition>.txt
+} PipelineStage;
+
+/**
+* Run a chain of MapReduce jobs. The first stage maps the input files with
+* mapper; every later stage runs a map task per partition of the stage
+* before it, calling its RecordMapper on each result that stage's reducer
+* wrote. Only the last stage writes result-<partition>.txt, as MR_Run does;
+* the results of the others stay in memory unless materialize is set.
+* Parameters:
+*     file_count  - Number of input files of the first stage
+*     file_names  - Array of input file names
+*     mapper      - Function pointer to the map function of the first stage
+*     stages      - Stages, in order
+*     stage_count - Number of stages
+*     num_workers - Number of threads in the thread pool
+* Note: MR_Cancel stops the pipeline after the running stage's tasks, and
+*       MR_Cancelled then reports it
+*/
+void MR_RunPipeline(unsigned int file_count, char *file_names[], Mapper mapper,
+                    const PipelineStage *stages, unsigned int stage_count,
+                    unsigned int num_workers);
+
+#endif
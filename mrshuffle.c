@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include "mrshuffle.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Request flags
+#define FETCH_COMPRESS 1u
+// Response flags
+#define BLOCK_COMPRESSED 1u
+#define BLOCK_UNKNOWN 2u  // the server does not hold the map task's output
+
+// Request for a block of the run of a map task for a partition
+typedef struct {
+    uint32_t tag;     // echoed in the response
+    uint32_t map;
+    uint32_t part;
+    uint32_t len;     // most bytes to return
+    uint64_t offset;  // offset of the block in the run
+    uint32_t flags;
+    uint32_t pad;
+} FetchReq;
+
+// Response header, followed by wire_len bytes
+typedef struct {
+    uint32_t tag;
+    uint32_t flags;
+    uint64_t total;     // size of the whole run (0 if the task emitted nothing)
+    uint64_t offset;
+    uint32_t req_len;   // len of the request
+    uint32_t raw_len;   // bytes of the run in this block
+    uint32_t wire_len;  // bytes that follow
+    uint32_t pad;
+} FetchResp;
+
+// Run of a map task for a partition, held by a server
+typedef struct {
+    unsigned int map;
+    unsigned int part;
+    int fd;
+    size_t len;
+} Segment;
+
+struct ShuffleServer {
+    int listen_fd;
+    unsigned short port;
+    pthread_mutex_t lock;
+    Segment *segments;
+    size_t count;
+    size_t cap;
+    unsigned int *maps;  // map tasks published, including those with no output
+    size_t map_count;
+    size_t map_cap;
+};
+
+// A run being fetched
+typedef struct {
+    unsigned int map;
+    unsigned int conn;   // connection to the server holding it
+    uint64_t total;      // size, known after the first response
+    bool known;
+    uint64_t requested;  // bytes requested so far
+    uint64_t received;   // bytes received so far
+    int fd;              // memfd the run is assembled in
+    unsigned char *data; // mapping of fd
+    bool done;
+} Fetch;
+
+// A connection to one server
+typedef struct {
+    unsigned short port;
+    int sock;
+    unsigned int outstanding;  // responses still to read
+} Conn;
+
+static bool read_full(int fd, void *buf, size_t len) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Find a segment, and whether the map task is known at all. The segment
+// gets its own descriptor, which the caller closes, so that a rerun of the
+// task replacing it cannot close it while a block is sent.
+static bool find_segment(ShuffleServer *server, unsigned int map, unsigned int part,
+                         Segment *seg) {
+    bool known = false;
+    seg->fd = -1;
+    seg->len = 0;
+    pthread_mutex_lock(&server->lock);
+    for (size_t i = 0; i < server->map_count && !known; i++) {
+        known = server->maps[i] == map;
+    }
+    for (size_t i = 0; known && i < server->count; i++) {
+        if (server->segments[i].map == map && server->segments[i].part == part) {
+            *seg = server->segments[i];
+            seg->fd = fcntl(seg->fd, F_DUPFD_CLOEXEC, 0);
+            // a segment that cannot be sent is reported as lost, so that
+            // its task runs again
+            if (seg->fd < 0) known = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return known;
+}
+
+// Send one block of a segment, compressed if asked for and worthwhile
+static bool send_block(int sock, const FetchReq *req, const Segment *seg,
+                       unsigned char *buf, unsigned char *cbuf, size_t cbuf_len) {
+    FetchResp resp = { req->tag, 0, seg->len, req->offset, req->len, 0, 0, 0 };
+    if (req->offset < seg->len) {
+        uint64_t left = seg->len - req->offset;
+        resp.raw_len = (uint32_t)(left < req->len ? left : req->len);
+    }
+    resp.wire_len = resp.raw_len;
+
+#ifdef HAVE_ZLIB
+    if ((req->flags & FETCH_COMPRESS) && resp.raw_len > 0) {
+        if (pread(seg->fd, buf, resp.raw_len, (off_t)req->offset) != (ssize_t)resp.raw_len) {
+            return false;
+        }
+        uLongf clen = cbuf_len;
+        if (compress2(cbuf, &clen, buf, resp.raw_len, Z_BEST_SPEED) == Z_OK &&
+            clen < resp.raw_len) {
+            resp.flags |= BLOCK_COMPRESSED;
+            resp.wire_len = (uint32_t)clen;
+            return write_full(sock, &resp, sizeof(resp)) && write_full(sock, cbuf, clen);
+        }
+        return write_full(sock, &resp, sizeof(resp)) && write_full(sock, buf, resp.raw_len);
+    }
+#endif
+
+    // uncompressed blocks go from the segment to the socket without a copy
+    if (!write_full(sock, &resp, sizeof(resp))) return false;
+    off_t off = (off_t)req->offset;
+    size_t left = resp.raw_len;
+    while (left > 0) {
+        ssize_t n = sendfile(sock, seg->fd, &off, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        left -= (size_t)n;
+    }
+    return true;
+}
+
+// Serve the requests of one connection until it closes
+static void *serve_conn(void *arg) {
+    ShuffleServer *server = ((void **)arg)[0];
+    int sock = (int)(intptr_t)((void **)arg)[1];
+    free(arg);
+
+    unsigned char *buf = malloc(SHUFFLE_BLOCK_BYTES);
+    size_t cbuf_len = SHUFFLE_BLOCK_BYTES + SHUFFLE_BLOCK_BYTES / 100 + 1024;
+    unsigned char *cbuf = malloc(cbuf_len);
+
+    FetchReq req;
+    while (buf && cbuf && read_full(sock, &req, sizeof(req))) {
+        if (req.len > SHUFFLE_BLOCK_BYTES) req.len = SHUFFLE_BLOCK_BYTES;
+        Segment seg;
+        if (!find_segment(server, req.map, req.part, &seg)) {
+            FetchResp resp = { req.tag, BLOCK_UNKNOWN, 0, req.offset, req.len, 0, 0, 0 };
+            if (!write_full(sock, &resp, sizeof(resp))) break;
+            continue;
+        }
+        bool sent = send_block(sock, &req, &seg, buf, cbuf, cbuf_len);
+        if (seg.fd >= 0) close(seg.fd);
+        if (!sent) break;
+    }
+
+    free(buf);
+    free(cbuf);
+    close(sock);
+    return NULL;
+}
+
+// Accept connections, each served by its own thread
+static void *accept_loop(void *arg) {
+    ShuffleServer *server = arg;
+    while (1) {
+        int sock = accept(server->listen_fd, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        void **args = malloc(2 * sizeof(void *));
+        pthread_t thread;
+        if (!args) {
+            close(sock);
+            continue;
+        }
+        args[0] = server;
+        args[1] = (void *)(intptr_t)sock;
+        if (pthread_create(&thread, NULL, serve_conn, args) != 0) {
+            free(args);
+            close(sock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+// Start serving map output
+ShuffleServer *Shuffle_serve(void) {
+    ShuffleServer *server = calloc(1, sizeof(ShuffleServer));
+    if (!server) return NULL;
+    pthread_mutex_init(&server->lock, NULL);
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0 ||
+        bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 64) != 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        goto fail;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, accept_loop, server) != 0) goto fail;
+    pthread_detach(thread);
+    return server;
+
+fail:
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+    return NULL;
+}
+
+// Port of a server
+unsigned short Shuffle_port(const ShuffleServer *server) {
+    return server->port;
+}
+
+// Add the output of a map task to a server
+bool Shuffle_publish(ShuffleServer *server, unsigned int map, const int *fds,
+                     const unsigned int *parts, unsigned int count) {
+    pthread_mutex_lock(&server->lock);
+    bool ok = true;
+    if (server->count + count > server->cap) {
+        size_t cap = server->cap ? server->cap : 64;
+        while (cap < server->count + count) cap *= 2;
+        Segment *grown = realloc(server->segments, cap * sizeof(Segment));
+        if (grown) {
+            server->segments = grown;
+            server->cap = cap;
+        } else {
+            ok = false;
+        }
+    }
+    if (ok && server->map_count == server->map_cap) {
+        size_t cap = server->map_cap ? server->map_cap * 2 : 64;
+        unsigned int *grown = realloc(server->maps, cap * sizeof(unsigned int));
+        if (grown) {
+            server->maps = grown;
+            server->map_cap = cap;
+        } else {
+            ok = false;
+        }
+    }
+
+    // a task run again replaces the output of its earlier run
+    size_t kept = 0;
+    for (size_t i = 0; ok && i < server->count; i++) {
+        if (server->segments[i].map == map) {
+            close(server->segments[i].fd);
+        } else {
+            server->segments[kept++] = server->segments[i];
+        }
+    }
+    if (ok) server->count = kept;
+
+    for (unsigned int i = 0; i < count; i++) {
+        struct stat st;
+        if (!ok || fstat(fds[i], &st) != 0) {
+            ok = false;
+            close(fds[i]);
+            continue;
+        }
+        Segment *seg = &server->segments[server->count++];
+        seg->map = map;
+        seg->part = parts[i];
+        seg->fd = fds[i];
+        seg->len = (size_t)st.st_size;
+    }
+    bool known = false;
+    for (size_t i = 0; i < server->map_count && !known; i++) known = server->maps[i] == map;
+    if (ok && !known) server->maps[server->map_count++] = map;
+    pthread_mutex_unlock(&server->lock);
+    return ok;
+}
+
+// Connect to a server on the loopback interface
+static int connect_server(unsigned short port) {
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+// Hand a completed run to the sink
+static void finish_fetch(Fetch *f, unsigned int *remaining, ShuffleSink sink, void *ctx) {
+    if (f->data) munmap(f->data, f->total);
+    f->data = NULL;
+    if (f->fd >= 0) {
+        sink(f->fd, ctx);
+        close(f->fd);
+        f->fd = -1;
+    }
+    f->done = true;
+    (*remaining)--;
+}
+
+// Read one response and place its block in the run it belongs to
+static bool receive_block(Conn *conn, Fetch *fetches, unsigned int count, unsigned char *wire,
+                          size_t *in_flight, unsigned int *remaining, ShuffleSink sink,
+                          void *ctx) {
+    FetchResp resp;
+    if (!read_full(conn->sock, &resp, sizeof(resp))) return false;
+    conn->outstanding--;
+    *in_flight -= resp.req_len;
+    if (resp.tag >= count || (resp.flags & BLOCK_UNKNOWN)) return false;
+    Fetch *f = &fetches[resp.tag];
+
+    if (!f->known) {
+        f->known = true;
+        f->total = resp.total;
+        if (f->requested > f->total) f->requested = f->total;
+        if (f->total > 0) {
+            f->fd = memfd_create("mr-fetch", MFD_CLOEXEC);
+            if (f->fd < 0 || ftruncate(f->fd, (off_t)f->total) != 0) return false;
+            f->data = mmap(NULL, f->total, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+            if (f->data == MAP_FAILED) {
+                f->data = NULL;
+                return false;
+            }
+        }
+    }
+    if (resp.offset + resp.raw_len > f->total || resp.wire_len > SHUFFLE_BLOCK_BYTES * 2) {
+        return false;
+    }
+
+    if (resp.flags & BLOCK_COMPRESSED) {
+#ifdef HAVE_ZLIB
+        if (!read_full(conn->sock, wire, resp.wire_len)) return false;
+        uLongf raw = resp.raw_len;
+        if (uncompress(f->data + resp.offset, &raw, wire, resp.wire_len) != Z_OK ||
+            raw != resp.raw_len) {
+            return false;
+        }
+#else
+        return false;
+#endif
+    } else if (resp.raw_len > 0) {
+        // uncompressed blocks are read straight into place
+        if (!read_full(conn->sock, f->data + resp.offset, resp.raw_len)) return false;
+    }
+
+    f->received += resp.raw_len;
+    if (f->received == f->total && f->requested == f->total) {
+        finish_fetch(f, remaining, sink, ctx);
+    }
+    return true;
+}
+
+// Fetch the runs of a partition
+bool Shuffle_fetch(const ShuffleSource *sources, unsigned int count, unsigned int part,
+                   bool compress, size_t max_in_flight, ShuffleSink sink, void *ctx) {
+#ifndef HAVE_ZLIB
+    compress = false;
+#endif
+    if (max_in_flight < SHUFFLE_BLOCK_BYTES) max_in_flight = SHUFFLE_BLOCK_BYTES;
+
+    Fetch *fetches = calloc(count + 1, sizeof(Fetch));
+    Conn *conns = calloc(count + 1, sizeof(Conn));
+    FetchReq *batch = malloc((max_in_flight / SHUFFLE_BLOCK_BYTES + 1) * sizeof(FetchReq));
+    struct pollfd *pfds = calloc(count + 1, sizeof(struct pollfd));
+    unsigned char *wire = malloc(SHUFFLE_BLOCK_BYTES * 2);
+    unsigned int conn_count = 0, remaining = count;
+    bool ok = fetches && conns && batch && pfds && wire;
+
+    // one connection per server
+    for (unsigned int i = 0; ok && i < count; i++) {
+        unsigned int c = 0;
+        while (c < conn_count && conns[c].port != sources[i].port) c++;
+        if (c == conn_count) {
+            conns[c].port = sources[i].port;
+            conns[c].sock = connect_server(sources[i].port);
+            if (conns[c].sock < 0) ok = false;
+            conn_count++;
+        }
+        fetches[i].map = sources[i].map;
+        fetches[i].conn = c;
+        fetches[i].fd = -1;
+    }
+
+    size_t in_flight = 0;
+    unsigned int next = 0;  // where the round-robin over runs resumes
+    while (ok && remaining > 0) {
+        // request more blocks, batched per connection, while the bound allows
+        for (unsigned int c = 0; c < conn_count; c++) {
+            unsigned int n = 0;
+            for (unsigned int k = 0; k < count; k++) {
+                Fetch *f = &fetches[(next + k) % count];
+                if (f->conn != c || f->done) continue;
+                // before the first response the size is unknown, so only
+                // one block is asked for
+                if (f->known ? f->requested >= f->total : f->requested > 0) continue;
+                if (in_flight > 0 && in_flight + SHUFFLE_BLOCK_BYTES > max_in_flight) break;
+
+                FetchReq *req = &batch[n++];
+                memset(req, 0, sizeof(*req));
+                req->tag = (uint32_t)((next + k) % count);
+                req->map = f->map;
+                req->part = part;
+                req->offset = f->requested;
+                req->len = SHUFFLE_BLOCK_BYTES;
+                req->flags = compress ? FETCH_COMPRESS : 0;
+                f->requested += SHUFFLE_BLOCK_BYTES;
+                if (f->known && f->requested > f->total) f->requested = f->total;
+                in_flight += SHUFFLE_BLOCK_BYTES;
+                if (n > max_in_flight / SHUFFLE_BLOCK_BYTES) break;
+            }
+            if (n > 0 && !write_full(conns[c].sock, batch, n * sizeof(FetchReq))) {
+                ok = false;
+                break;
+            }
+            conns[c].outstanding += n;
+        }
+        next = (next + 1) % (count ? count : 1);
+        if (!ok) break;
+
+        // read whatever responses have arrived
+        unsigned int waiting = 0;
+        for (unsigned int c = 0; c < conn_count; c++) {
+            pfds[c].fd = conns[c].outstanding > 0 ? conns[c].sock : -1;
+            pfds[c].events = POLLIN;
+            pfds[c].revents = 0;
+            if (conns[c].outstanding > 0) waiting++;
+        }
+        if (waiting == 0) {
+            ok = false;  // nothing requested, yet runs are missing
+            break;
+        }
+        if (poll(pfds, conn_count, -1) < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        for (unsigned int c = 0; ok && c < conn_count; c++) {
+            if (pfds[c].revents == 0) continue;
+            ok = receive_block(&conns[c], fetches, count, wire, &in_flight, &remaining,
+                               sink, ctx);
+        }
+    }
+
+    for (unsigned int i = 0; fetches && i < count; i++) {
+        if (fetches[i].data) munmap(fetches[i].data, fetches[i].total);
+        if (fetches[i].fd >= 0) close(fetches[i].fd);
+    }
+    for (unsigned int c = 0; conns && c < conn_count; c++) {
+        if (conns[c].sock >= 0) close(conns[c].sock);
+    }
+    free(fetches);
+    free(conns);
+    free(batch);
+    free(pfds);
+    free(wire);
+    return ok;
+}
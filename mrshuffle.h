@@ -0,0 +1,79 @@
+// Socket shuffle service: each worker process serves the map output it
+// holds over TCP, and reduce tasks fetch it in pipelined, batched and
+// optionally compressed blocks.
+#ifndef MRSHUFFLE_H
+#define MRSHUFFLE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+// Size of the blocks runs are fetched in
+#define SHUFFLE_BLOCK_BYTES (256u << 10)
+// Default bound on the bytes requested but not yet received by a fetch
+#define SHUFFLE_DEFAULT_IN_FLIGHT (8u << 20)
+
+typedef struct ShuffleServer ShuffleServer;
+
+// A map task whose output a fetch should read, and the server holding it
+typedef struct {
+    unsigned int map;
+    unsigned short port;
+} ShuffleSource;
+
+// Receives a fetched run, held in a memfd that is closed once this returns
+typedef void (*ShuffleSink)(int fd, void *ctx);
+
+/**
+* Start serving map output on an ephemeral loopback port, from a thread
+* of the calling process
+* Return:
+*     ShuffleServer* - Server, or NULL if it cannot listen
+*/
+ShuffleServer *Shuffle_serve(void);
+
+/**
+* Get the port a server listens on
+* Parameters:
+*     server - Server returned by Shuffle_serve
+* Return:
+*     unsigned short - Port on 127.0.0.1
+*/
+unsigned short Shuffle_port(const ShuffleServer *server);
+
+/**
+* Make the output of a map task available to fetches
+* Parameters:
+*     server - Server returned by Shuffle_serve
+*     map    - Map task index
+*     fds    - Files holding the task's run for each partition in parts;
+*              the server takes them over
+*     parts  - Partition of each file
+*     count  - Number of files (partitions the task emitted nothing for
+*              are fetched as empty)
+* Return:
+*     true  - On success
+*     false - Otherwise (the files are closed)
+*/
+bool Shuffle_publish(ShuffleServer *server, unsigned int map, const int *fds,
+                     const unsigned int *parts, unsigned int count);
+
+/**
+* Fetch the runs of one partition from the servers holding them. Requests
+* for blocks of every run are sent in batches per server and pipelined,
+* keeping at most max_in_flight bytes requested but not yet received.
+* Parameters:
+*     sources       - Map tasks to fetch the partition's run of
+*     count         - Number of sources
+*     part          - Partition
+*     compress      - Whether to ask for zlib-compressed blocks (ignored
+*                     when built without zlib)
+*     max_in_flight - Bound on outstanding bytes (at least one block)
+*     sink          - Called with each run once it is complete
+*     ctx           - Passed through to sink
+* Return:
+*     true  - If every run was fetched
+*     false - If a server could not be reached or failed
+*/
+bool Shuffle_fetch(const ShuffleSource *sources, unsigned int count, unsigned int part,
+                   bool compress, size_t max_in_flight, ShuffleSink sink, void *ctx);
+
+#endif
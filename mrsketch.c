@@ -0,0 +1,181 @@
+#include "mrsketch.h"
+#include "mapreduce_ext.h"
+#include "mrcore.h"
+#include "mrhll.h"
+#include "mrinput.h"
+#include "threadpool.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Sketch {
+    uint64_t total;
+    double epsilon;
+    uint32_t width_mask;   // Count-Min row width - 1 (a power of two)
+    uint32_t depth;        // Count-Min rows
+    uint64_t *counts;      // depth rows of width counters
+    HyperLogLog *distinct;
+    struct Sketch *next;   // in the list of thread sketches
+};
+
+// Global variables
+static SketchConfig config;
+static Sketch *thread_sketches = NULL;  // one per worker thread that emitted
+static pthread_mutex_t sketches_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int run_id = 0;
+static bool out_of_memory = false;
+
+// Sketch of the calling thread, valid while thread_run is run_id
+static __thread Sketch *thread_sketch = NULL;
+static __thread unsigned int thread_run = 0;
+
+static Sketch *sketch_create(void) {
+    Sketch *sketch = calloc(1, sizeof(Sketch));
+    if (!sketch) return NULL;
+    uint64_t width = 1;
+    while (width < ceil(M_E / config.epsilon) && width < (1u << 31)) width *= 2;
+    sketch->epsilon = config.epsilon;
+    sketch->width_mask = (uint32_t)(width - 1);
+    sketch->depth = (uint32_t)ceil(log(1 / config.delta));
+    if (sketch->depth == 0) sketch->depth = 1;
+    sketch->counts = calloc(width * sketch->depth, sizeof(uint64_t));
+    sketch->distinct = Hll_create(config.precision);
+    if (!sketch->counts || !sketch->distinct) {
+        Sketch_free(sketch);
+        return NULL;
+    }
+    return sketch;
+}
+
+// Add a count to a key. Row i hashes the key with h1 + i * h2, which is as
+// good as independent hashes for Count-Min.
+static void sketch_add(Sketch *sketch, const char *key, uint64_t count) {
+    uint64_t hash = Hll_hash(key);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    size_t width = (size_t)sketch->width_mask + 1;
+    for (uint32_t i = 0; i < sketch->depth; i++) {
+        sketch->counts[i * width + ((h1 + i * h2) & sketch->width_mask)] += count;
+    }
+    sketch->total += count;
+    Hll_add_hash(sketch->distinct, hash);
+}
+
+// Fold one sketch into another of the same size
+static void sketch_merge(Sketch *into, const Sketch *from) {
+    size_t cells = ((size_t)into->width_mask + 1) * into->depth;
+    for (size_t i = 0; i < cells; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    Hll_merge(into->distinct, from->distinct);
+    into->total += from->total;
+}
+
+// Emit function: add the record to the sketch of the thread
+static void sketch_emit(char *key, char *value, unsigned int partition_idx) {
+    if (thread_run != run_id) {
+        thread_run = run_id;
+        thread_sketch = sketch_create();
+        pthread_mutex_lock(&sketches_lock);
+        if (thread_sketch) {
+            thread_sketch->next = thread_sketches;
+            thread_sketches = thread_sketch;
+        } else {
+            out_of_memory = true;
+        }
+        pthread_mutex_unlock(&sketches_lock);
+    }
+    if (!thread_sketch) return;
+    // a value that is not a number counts the record once; a negative one
+    // adds nothing, as Count-Min only stays an upper bound while counts grow
+    char *end;
+    long long count = strtoll(value, &end, 10);
+    if (end == value) count = 1;
+    sketch_add(thread_sketch, key, count > 0 ? (uint64_t)count : 0);
+}
+
+static void submit_map_job(InputFile *file, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, file);
+}
+
+// Main approximate execution function
+Sketch *MR_RunSketch(unsigned int file_count, char *file_names[], Mapper mapper,
+                     const SketchConfig *cfg, unsigned int num_workers) {
+    config = *cfg;
+    if (config.epsilon <= 0 || config.epsilon >= 1) config.epsilon = 0.0001;
+    if (config.delta <= 0 || config.delta >= 1) config.delta = 0.01;
+    run_id++;
+    out_of_memory = false;
+
+    Core_init(mapper, 1);
+    Core_set_emit(sketch_emit);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    // Map Phase: each worker thread sketches what its tasks emit
+    InputFile *files = malloc((file_count + 1) * sizeof(InputFile));
+    if (files) {
+        Input_prepare(pool, file_count, file_names, files, submit_map_job, pool);
+        Core_wait(pool);
+        Input_release(files, file_count);
+        free(files);
+    }
+    ThreadPool_destroy(pool);
+    Core_set_emit(NULL);
+    bool failed = !files || out_of_memory || MR_Cancelled();
+    Core_finish();
+
+    // Merge the thread sketches into one
+    Sketch *merged = thread_sketches ? thread_sketches : sketch_create();
+    Sketch *other = thread_sketches ? thread_sketches->next : NULL;
+    thread_sketches = NULL;
+    while (other) {
+        Sketch *next = other->next;
+        if (merged) sketch_merge(merged, other);
+        Sketch_free(other);
+        other = next;
+    }
+    if (merged) merged->next = NULL;
+    if (failed) {
+        Sketch_free(merged);
+        return NULL;
+    }
+    return merged;
+}
+
+// Estimate the count of a key: the least of its counters
+uint64_t Sketch_count(const Sketch *sketch, const char *key) {
+    uint64_t hash = Hll_hash(key);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    size_t width = (size_t)sketch->width_mask + 1;
+    uint64_t least = UINT64_MAX;
+    for (uint32_t i = 0; i < sketch->depth; i++) {
+        uint64_t count = sketch->counts[i * width + ((h1 + i * h2) & sketch->width_mask)];
+        if (count < least) least = count;
+    }
+    return least;
+}
+
+// Get the bound on the overestimate of a count
+uint64_t Sketch_error(const Sketch *sketch) {
+    return (uint64_t)ceil(sketch->epsilon * (double)sketch->total);
+}
+
+// Get the sum of all counts
+uint64_t Sketch_total(const Sketch *sketch) {
+    return sketch->total;
+}
+
+// Estimate the number of distinct keys
+double Sketch_distinct(const Sketch *sketch, double *relative_error) {
+    if (relative_error) *relative_error = Hll_error(sketch->distinct);
+    return Hll_estimate(sketch->distinct);
+}
+
+// Free a sketch
+void Sketch_free(Sketch *sketch) {
+    if (!sketch) return;
+    free(sketch->counts);
+    Hll_free(sketch->distinct);
+    free(sketch);
+}
@@ -0,0 +1,66 @@
+// Approximate counting: map tasks fold their records into sketches of the
+// worker thread they run on (a Count-Min sketch of the counts of keys and
+// a HyperLogLog of the distinct keys), which are merged once the map phase
+// ends. Nothing is shuffled or reduced.
+#ifndef MRSKETCH_H
+#define MRSKETCH_H
+#include <stdint.h>
+#include "mapreduce.h"
+
+typedef struct Sketch Sketch;
+
+typedef struct {
+    double epsilon;           // counts are overestimated by at most
+                              // epsilon * total (e.g. 0.0001) ...
+    double delta;             // ... except with probability delta (e.g. 0.01)
+    unsigned int precision;   // HyperLogLog registers: 2^precision (4 to 18)
+} SketchConfig;
+
+/**
+* Run a job approximately. Every record the mapper emits with MR_Emit
+* adds its value, read as an integer, to the count of its key: a value that
+* is not a number adds 1, and a negative one adds 0 (counts only grow).
+* Parameters:
+*     file_count  - Number of files (i.e. input splits)
+*     file_names  - Array of filenames
+*     mapper      - Function pointer to the map function
+*     config      - Size of the sketches
+*     num_workers - Number of threads in the thread pool
+* Return:
+*     Sketch* - Merged sketch, freed with Sketch_free, or NULL if out of
+*               memory or cancelled
+*/
+Sketch *MR_RunSketch(unsigned int file_count, char *file_names[], Mapper mapper,
+                     const SketchConfig *config, unsigned int num_workers);
+
+/**
+* Estimate the count of a key; never below the true count, and above it by
+* at most Sketch_error except with probability delta
+*/
+uint64_t Sketch_count(const Sketch *sketch, const char *key);
+
+/**
+* Get the bound on how far Sketch_count overestimates: epsilon * total
+*/
+uint64_t Sketch_error(const Sketch *sketch);
+
+/**
+* Get the sum of the counts of all keys (exact)
+*/
+uint64_t Sketch_total(const Sketch *sketch);
+
+/**
+* Estimate the number of distinct keys
+* Parameters:
+*     sketch         - Sketch to read
+*     relative_error - Set to the standard error of the estimate, relative
+*                      to it (1.04 / sqrt(registers)), unless NULL
+*/
+double Sketch_distinct(const Sketch *sketch, double *relative_error);
+
+/**
+* Free a sketch
+*/
+void Sketch_free(Sketch *sketch);
+
+#endif
@@ -0,0 +1,449 @@
+#define _GNU_SOURCE
+#include "mrstream.h"
+#include "mrcore.h"
+#include "mrinput.h"
+#include "mrtable.h"
+#include "threadpool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most bytes taken from one input per batch, so a backlog is worked off
+// over several batches instead of stalling one
+#define MAX_BATCH_BYTES (64u << 20)
+#define STORE_INITIAL_BUCKETS 1024
+
+// An input being tailed
+typedef struct {
+    char *name;
+    int fd;
+    bool pipe;     // read until end of stream rather than tailed by size
+    bool eof;
+    off_t offset;  // next byte of a tailed file to read
+    char *buf;     // bytes read but not yet handed out (partial last line)
+    size_t len;
+    size_t cap;
+} StreamInput;
+
+// Windowed state of one key
+typedef struct StateEntry {
+    char *key;
+    char **panes;  // ring of per-pane results, NULL where the key had none
+    struct StateEntry *next;
+} StateEntry;
+
+// Hash table holding the state of the keys of one partition
+typedef struct {
+    StateEntry **buckets;
+    size_t nbuckets;
+    size_t count;
+} StateStore;
+
+// Arguments for window emission jobs
+typedef struct {
+    unsigned int partition_idx;
+    long long pane;  // pane being closed
+} CloseArgs;
+
+// Global variables
+static StateStore *stores = NULL;
+static unsigned int num_stores = 0;
+static StreamConfig cfg;
+static unsigned int panes_per_window = 1;
+static long long current_pane = 0;  // pane that reduce results go to
+static long long start_wall_ms = 0;
+static pthread_mutex_t sink_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t stop_requested = 0;
+
+static long long now_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void store_init(StateStore *store) {
+    store->nbuckets = STORE_INITIAL_BUCKETS;
+    store->buckets = calloc(store->nbuckets, sizeof(StateEntry *));
+    store->count = 0;
+}
+
+static void store_grow(StateStore *store) {
+    size_t nbuckets = store->nbuckets * 2;
+    StateEntry **buckets = calloc(nbuckets, sizeof(StateEntry *));
+    if (!buckets) return;
+    for (size_t i = 0; i < store->nbuckets; i++) {
+        StateEntry *e = store->buckets[i];
+        while (e) {
+            StateEntry *next = e->next;
+            size_t b = Table_hash(e->key) & (nbuckets - 1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(store->buckets);
+    store->buckets = buckets;
+    store->nbuckets = nbuckets;
+}
+
+// Find the state of key, creating it if needed
+static StateEntry *store_get(StateStore *store, const char *key) {
+    size_t b = Table_hash(key) & (store->nbuckets - 1);
+    for (StateEntry *e = store->buckets[b]; e; e = e->next) {
+        if (strcmp(e->key, key) == 0) return e;
+    }
+
+    StateEntry *e = malloc(sizeof(StateEntry));
+    if (!e) return NULL;
+    e->key = strdup(key);
+    e->panes = calloc(panes_per_window, sizeof(char *));
+    e->next = store->buckets[b];
+    store->buckets[b] = e;
+    if (++store->count > store->nbuckets) store_grow(store);
+    return e;
+}
+
+static void entry_free(StateEntry *e) {
+    for (unsigned int i = 0; i < panes_per_window; i++) {
+        free(e->panes[i]);
+    }
+    free(e->panes);
+    free(e->key);
+    free(e);
+}
+
+static void store_destroy(StateStore *store) {
+    for (size_t i = 0; i < store->nbuckets; i++) {
+        StateEntry *e = store->buckets[i];
+        while (e) {
+            StateEntry *next = e->next;
+            entry_free(e);
+            e = next;
+        }
+    }
+    free(store->buckets);
+}
+
+static unsigned int pane_slot(long long pane) {
+    long long slot = pane % panes_per_window;
+    return (unsigned int)(slot < 0 ? slot + panes_per_window : slot);
+}
+
+// MR_Output target while streaming: fold a batch result into the current
+// pane of the key (each partition is reduced by a single job, so its store
+// needs no lock)
+static void stream_output(char *key, char *value, unsigned int partition_idx) {
+    StateEntry *e = store_get(&stores[partition_idx], key);
+    if (!e) return;
+
+    char **slot = &e->panes[pane_slot(current_pane)];
+    if (*slot == NULL) {
+        *slot = strdup(value);
+    } else {
+        char *merged = cfg.merge(*slot, value);
+        free(*slot);
+        *slot = merged;
+    }
+}
+
+static void print_window(const char *key, const char *value,
+                         long long start_ms, long long end_ms, void *ctx) {
+    printf("[%lld, %lld) %s: %s\n", start_ms, end_ms, key, value);
+}
+
+// Emit the window ending with a pane for every key of a partition, then
+// drop the pane that falls out of the next window
+static void close_pane_job(void *arg) {
+    CloseArgs *close_args = (CloseArgs *)arg;
+    StateStore *store = &stores[close_args->partition_idx];
+    long long pane = close_args->pane;
+    free(close_args);
+
+    long long end_ms = start_wall_ms + (pane + 1) * (long long)cfg.slide_ms;
+    long long start_ms = end_ms - (long long)panes_per_window * cfg.slide_ms;
+    unsigned int expiring = pane_slot(pane + 1);
+
+    for (size_t b = 0; b < store->nbuckets; b++) {
+        StateEntry **link = &store->buckets[b];
+        while (*link) {
+            StateEntry *e = *link;
+
+            // merge oldest to newest
+            char *result = NULL;
+            for (long long p = pane - panes_per_window + 1; p <= pane; p++) {
+                char *part = e->panes[pane_slot(p)];
+                if (!part) continue;
+                if (!result) {
+                    result = strdup(part);
+                } else {
+                    char *merged = cfg.merge(result, part);
+                    free(result);
+                    result = merged;
+                }
+            }
+            if (result) {
+                pthread_mutex_lock(&sink_lock);
+                cfg.sink(e->key, result, start_ms, end_ms, cfg.sink_ctx);
+                pthread_mutex_unlock(&sink_lock);
+                free(result);
+            }
+
+            free(e->panes[expiring]);
+            e->panes[expiring] = NULL;
+
+            bool empty = true;
+            for (unsigned int i = 0; i < panes_per_window && empty; i++) {
+                empty = e->panes[i] == NULL;
+            }
+            if (empty) {
+                *link = e->next;
+                entry_free(e);
+                store->count--;
+            } else {
+                link = &e->next;
+            }
+        }
+    }
+}
+
+// Close every pane before upto, emitting the windows that end with them
+static void close_panes(ThreadPool_t *tp, long long upto) {
+    while (current_pane < upto) {
+        for (unsigned int i = 0; i < num_stores; i++) {
+            CloseArgs *ca = malloc(sizeof(*ca));
+            if (!ca) continue;
+            ca->partition_idx = i;
+            ca->pane = current_pane;
+            Core_add_task(tp, close_pane_job, ca, stores[i].count);
+        }
+        Core_wait(tp);
+        current_pane++;
+
+        // with no state left the remaining panes would emit nothing
+        size_t keys = 0;
+        for (unsigned int i = 0; i < num_stores; i++) {
+            keys += stores[i].count;
+        }
+        if (keys == 0) current_pane = upto;
+    }
+}
+
+static bool input_reserve(StreamInput *in, size_t extra) {
+    if (in->len + extra <= in->cap) return true;
+    size_t cap = in->cap ? in->cap : 4096;
+    while (cap < in->len + extra) cap *= 2;
+    char *buf = realloc(in->buf, cap);
+    if (!buf) return false;
+    in->buf = buf;
+    in->cap = cap;
+    return true;
+}
+
+static void input_open(StreamInput *in, char *name) {
+    memset(in, 0, sizeof(*in));
+    in->name = name;
+    in->fd = -1;
+
+    struct stat st;
+    if (strcmp(name, "-") == 0) {
+        in->fd = STDIN_FILENO;
+        in->pipe = true;
+    } else {
+        // opening a FIFO blocks until it has a writer, so reads below only
+        // see end of stream once that writer is gone
+        in->fd = open(name, O_RDONLY);
+        if (in->fd < 0 || fstat(in->fd, &st) != 0) {
+            perror(name);
+            if (in->fd >= 0) close(in->fd);
+            in->fd = -1;
+            in->eof = true;
+            return;
+        }
+        in->pipe = !S_ISREG(st.st_mode);
+        if (!in->pipe && !cfg.from_start) in->offset = st.st_size;
+    }
+
+    if (in->pipe) {
+        int flags = fcntl(in->fd, F_GETFL);
+        fcntl(in->fd, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+// Read whatever has been appended to an input since the last batch
+static void input_poll(StreamInput *in) {
+    if (in->pipe) {
+        size_t taken = 0;
+        while (taken < MAX_BATCH_BYTES && input_reserve(in, 65536)) {
+            ssize_t n = read(in->fd, in->buf + in->len, in->cap - in->len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) break;
+            if (n <= 0) {
+                if (n < 0) perror(in->name);
+                in->eof = true;
+                break;
+            }
+            in->len += (size_t)n;
+            taken += (size_t)n;
+        }
+        return;
+    }
+
+    struct stat st;
+    if (fstat(in->fd, &st) != 0) return;
+    if (st.st_size < in->offset) {
+        // truncated (e.g. rotated with copytruncate): start over
+        in->offset = 0;
+        in->len = 0;
+    }
+
+    size_t avail = (size_t)(st.st_size - in->offset);
+    if (avail > MAX_BATCH_BYTES) avail = MAX_BATCH_BYTES;
+    if (avail == 0 || !input_reserve(in, avail)) return;
+
+    while (avail > 0) {
+        ssize_t n = pread(in->fd, in->buf + in->len, avail, in->offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        in->len += (size_t)n;
+        in->offset += n;
+        avail -= (size_t)n;
+    }
+}
+
+static void submit_block(InputFile *block, void *ctx) {
+    Core_map_input((ThreadPool_t *)ctx, block);
+}
+
+static void sleep_until(long long deadline_ms) {
+    long long wait = deadline_ms - now_ms(CLOCK_MONOTONIC);
+    if (wait <= 0) return;
+    struct timespec ts = { wait / 1000, (wait % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR && !stop_requested);
+}
+
+// Default configuration
+void Stream_default_config(StreamConfig *config) {
+    config->batch_ms = 200;
+    config->window_ms = 1000;
+    config->slide_ms = 1000;
+    config->duration_ms = 0;
+    config->from_start = false;
+    config->merge = Stream_merge_sum;
+    config->sink = print_window;
+    config->sink_ctx = NULL;
+}
+
+// Add two integer results
+char *Stream_merge_sum(const char *a, const char *b) {
+    char *sum = malloc(24);
+    if (sum) snprintf(sum, 24, "%lld", strtoll(a, NULL, 10) + strtoll(b, NULL, 10));
+    return sum;
+}
+
+// Request a running stream to stop
+void MR_StreamStop(void) {
+    stop_requested = 1;
+}
+
+// Main streaming execution function
+void MR_Stream(unsigned int file_count, char *file_names[],
+               Mapper mapper, Reducer reducer,
+               unsigned int num_workers, unsigned int num_parts,
+               const StreamConfig *config) {
+    if (config) {
+        cfg = *config;
+    } else {
+        Stream_default_config(&cfg);
+    }
+    if (cfg.batch_ms == 0) cfg.batch_ms = 200;
+    if (cfg.window_ms == 0) cfg.window_ms = 1000;
+    if (cfg.slide_ms == 0 || cfg.slide_ms > cfg.window_ms) cfg.slide_ms = cfg.window_ms;
+    if (!cfg.merge) cfg.merge = Stream_merge_sum;
+    if (!cfg.sink) cfg.sink = print_window;
+    panes_per_window = (cfg.window_ms + cfg.slide_ms - 1) / cfg.slide_ms;
+    stop_requested = 0;
+
+    num_stores = num_parts;
+    stores = malloc(num_parts * sizeof(StateStore));
+    for (unsigned int i = 0; i < num_parts; i++) {
+        store_init(&stores[i]);
+    }
+
+    StreamInput *inputs = malloc(file_count * sizeof(StreamInput));
+    for (unsigned int i = 0; i < file_count; i++) {
+        input_open(&inputs[i], file_names[i]);
+    }
+
+    Core_init(mapper, num_parts);
+    Core_set_output(stream_output);
+    ThreadPool_t *pool = ThreadPool_create(num_workers);
+
+    long long start_ms = now_ms(CLOCK_MONOTONIC);
+    long long next_batch = start_ms;
+    start_wall_ms = now_ms(CLOCK_REALTIME);
+    current_pane = 0;
+
+    for (;;) {
+        long long now = now_ms(CLOCK_MONOTONIC);
+        bool stopping = stop_requested ||
+                        (cfg.duration_ms > 0 && now - start_ms >= (long long)cfg.duration_ms);
+        long long batch_pane = (now - start_ms) / cfg.slide_ms;
+
+        // Map the new complete lines of every input
+        bool open_inputs = false;
+        for (unsigned int i = 0; i < file_count; i++) {
+            StreamInput *in = &inputs[i];
+            if (in->fd < 0 || in->eof) continue;
+            input_poll(in);
+            size_t used = Input_split_blocks(in->name, i, in->buf, in->len, in->eof, submit_block, pool);
+            memmove(in->buf, in->buf + used, in->len - used);
+            in->len -= used;
+            open_inputs |= !in->eof;
+        }
+        Core_wait(pool);
+
+        // Emit the windows that ended before this batch, then reduce the
+        // batch into the current pane
+        close_panes(pool, batch_pane);
+        Core_reduce(pool, reducer);
+
+        if (stopping || !open_inputs) break;
+
+        next_batch += cfg.batch_ms;
+        if (next_batch < now) next_batch = now;
+        sleep_until(next_batch);
+    }
+
+    // Emit the windows still open, including the partial current pane
+    close_panes(pool, current_pane + 1);
+
+    ThreadPool_destroy(pool);
+    Core_finish();
+
+    for (unsigned int i = 0; i < file_count; i++) {
+        if (inputs[i].fd == STDIN_FILENO) {
+            // stdin's file description is shared with our parent
+            int flags = fcntl(STDIN_FILENO, F_GETFL);
+            fcntl(STDIN_FILENO, F_SETFL, flags & ~O_NONBLOCK);
+        } else if (inputs[i].fd >= 0) {
+            close(inputs[i].fd);
+        }
+        free(inputs[i].buf);
+    }
+    free(inputs);
+
+    for (unsigned int i = 0; i < num_parts; i++) {
+        store_destroy(&stores[i]);
+    }
+    free(stores);
+    stores = NULL;
+    num_stores = 0;
+}
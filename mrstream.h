@@ -0,0 +1,80 @@
+// Micro-batch streaming engine: tails inputs, runs the usual mapper and
+// reducer over each batch of new lines and keeps windowed results per key.
+#ifndef MRSTREAM_H
+#define MRSTREAM_H
+#include <stdbool.h>
+#include "mapreduce.h"
+
+/**
+* Combine two results for the same key
+* Parameters:
+*     a - Older result
+*     b - Newer result
+* Return:
+*     char * - Combined result, allocated with malloc
+*/
+typedef char *(*StreamMerge)(const char *a, const char *b);
+
+/**
+* Receive the result of one key for a window
+* Parameters:
+*     key      - Key
+*     value    - Result of merging everything reduced for key in the window
+*     start_ms - Start of the window (ms since the epoch, inclusive)
+*     end_ms   - End of the window (ms since the epoch, exclusive)
+*     ctx      - sink_ctx from the StreamConfig
+*/
+typedef void (*WindowSink)(const char *key, const char *value,
+                           long long start_ms, long long end_ms, void *ctx);
+
+typedef struct {
+    unsigned int batch_ms;     // interval between micro-batches
+    unsigned int window_ms;    // window length, rounded up to a multiple of slide_ms
+    unsigned int slide_ms;     // window slide; equal to window_ms for tumbling windows
+    unsigned long long duration_ms;  // stop after this long (0 = run until stopped)
+    bool from_start;           // read existing file contents instead of only new lines
+    StreamMerge merge;         // combines reduce results across batches
+    WindowSink sink;           // receives window results
+    void *sink_ctx;            // passed through to sink
+} StreamConfig;
+
+/**
+* Fill in the default configuration: 200 ms batches, 1 s tumbling windows,
+* results summed with Stream_merge_sum and printed to stdout
+* Parameters:
+*     config - Configuration to fill in
+*/
+void Stream_default_config(StreamConfig *config);
+
+/**
+* Run the streaming engine until MR_StreamStop is called, duration_ms has
+* passed or every input is a pipe that has ended. Each batch maps the lines
+* appended to the inputs since the previous batch and reduces them; the
+* reducer reports its result for a key with MR_Output, which is merged into
+* the key's state for the current window.
+* Parameters:
+*     file_count  - Number of inputs (regular files are tailed, "-" is stdin)
+*     file_names  - Array of input names
+*     mapper      - Function pointer to the map function
+*     reducer     - Function pointer to the reduce function
+*     num_workers - Number of threads in the thread pool
+*     num_parts   - Number of partitions (and of per-key state stores)
+*     config      - Streaming configuration, or NULL for the defaults
+*/
+void MR_Stream(unsigned int file_count, char *file_names[],
+               Mapper mapper, Reducer reducer,
+               unsigned int num_workers, unsigned int num_parts,
+               const StreamConfig *config);
+
+/**
+* Ask a running MR_Stream to emit its current windows and return.
+* Safe to call from a signal handler.
+*/
+void MR_StreamStop(void);
+
+/**
+* StreamMerge that adds two integer results
+*/
+char *Stream_merge_sum(const char *a, const char *b);
+
+#endif
@@ -0,0 +1,187 @@
+#include "mrtable.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SLOTS 16
+
+// One slot; the hash is kept so that probes and growth rarely touch keys
+typedef struct {
+    size_t hash;
+    char *key;    // NULL if the slot is empty
+    char *value;
+} Slot;
+
+struct KVTable {
+    Slot *slots;
+    size_t mask;   // slot count - 1 (a power of two)
+    size_t count;
+};
+
+// Hash a key (FNV-1a)
+uint64_t Table_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Slot holding key, or the empty slot where it belongs
+static Slot *find_slot(const KVTable *table, const char *key, size_t hash) {
+    for (size_t s = hash & table->mask;; s = (s + 1) & table->mask) {
+        Slot *slot = &table->slots[s];
+        if (!slot->key || (slot->hash == hash && strcmp(slot->key, key) == 0)) return slot;
+    }
+}
+
+// Move the entries into count slots (a power of two)
+static bool resize(KVTable *table, size_t count) {
+    Slot *slots = calloc(count, sizeof(Slot));
+    if (!slots) return false;
+    Slot *old = table->slots;
+    size_t old_count = table->mask + 1;
+    table->slots = slots;
+    table->mask = count - 1;
+    for (size_t i = 0; i < old_count; i++) {
+        if (!old[i].key) continue;
+        size_t s = old[i].hash & table->mask;
+        while (slots[s].key) s = (s + 1) & table->mask;
+        slots[s] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+// Slots to hold expected keys at most half full
+static size_t slots_for(size_t expected) {
+    size_t count = MIN_SLOTS;
+    while (count < 2 * expected && count < SIZE_MAX / 4) count *= 2;
+    return count;
+}
+
+// Double the slots once they are half full
+static bool grow(KVTable *table) {
+    if (2 * (table->count + 1) <= table->mask + 1) return true;
+    return resize(table, 2 * (table->mask + 1));
+}
+
+// Create an empty table
+KVTable *Table_create(size_t expected) {
+    KVTable *table = malloc(sizeof(KVTable));
+    if (!table) return NULL;
+    size_t count = slots_for(expected);
+    table->slots = calloc(count, sizeof(Slot));
+    if (!table->slots) {
+        free(table);
+        return NULL;
+    }
+    table->mask = count - 1;
+    table->count = 0;
+    return table;
+}
+
+// Make room for keys without growing again
+bool Table_reserve(KVTable *table, size_t expected) {
+    size_t count = slots_for(expected);
+    if (count <= table->mask + 1) return true;
+    return resize(table, count);
+}
+
+// Add a key's value, or combine it with the one held
+bool Table_add(KVTable *table, const char *key, const char *value, TableCombine combine) {
+    size_t hash = Table_hash(key);
+    Slot *slot = find_slot(table, key, hash);
+    if (slot->key) {
+        char *combined = combine(key, slot->value, value);
+        if (!combined) return false;
+        free(slot->value);
+        slot->value = combined;
+        return true;
+    }
+
+    char *key_copy = strdup(key);
+    char *value_copy = strdup(value);
+    if (!key_copy || !value_copy || !grow(table)) {
+        free(key_copy);
+        free(value_copy);
+        return false;
+    }
+    slot = find_slot(table, key, hash);
+    slot->hash = hash;
+    slot->key = key_copy;
+    slot->value = value_copy;
+    table->count++;
+    return true;
+}
+
+// Look a key up
+const char *Table_get(const KVTable *table, const char *key) {
+    Slot *slot = find_slot(table, key, Table_hash(key));
+    return slot->key ? slot->value : NULL;
+}
+
+// Get the number of keys in a table
+size_t Table_count(const KVTable *table) {
+    return table->count;
+}
+
+// Move the entries of one table into another and free it
+bool Table_merge(KVTable *into, KVTable *from, TableCombine combine) {
+    bool ok = true;
+    for (size_t i = 0; i <= from->mask; i++) {
+        Slot *entry = &from->slots[i];
+        if (!entry->key) continue;
+        Slot *slot = ok ? find_slot(into, entry->key, entry->hash) : NULL;
+        if (slot && slot->key) {
+            char *combined = combine(entry->key, slot->value, entry->value);
+            if (combined) {
+                free(slot->value);
+                slot->value = combined;
+            } else {
+                ok = false;
+            }
+        } else if (slot && grow(into)) {
+            // the entry's strings move over as they are
+            *find_slot(into, entry->key, entry->hash) = *entry;
+            into->count++;
+            continue;
+        } else {
+            ok = false;
+        }
+        free(entry->key);
+        free(entry->value);
+    }
+    free(from->slots);
+    free(from);
+    return ok;
+}
+
+// Visit every entry of a table
+void Table_foreach(const KVTable *table, TableVisit visit, void *ctx) {
+    for (size_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i].key) visit(table->slots[i].key, table->slots[i].value, ctx);
+    }
+}
+
+// Hand every entry of a table over and free it
+void Table_drain(KVTable *table, TableTake take, void *ctx) {
+    for (size_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i].key) take(table->slots[i].key, table->slots[i].value, ctx);
+    }
+    free(table->slots);
+    free(table);
+}
+
+// Free a table and its entries
+void Table_free(KVTable *table) {
+    if (!table) return;
+    for (size_t i = 0; i <= table->mask; i++) {
+        free(table->slots[i].key);
+        free(table->slots[i].value);
+    }
+    free(table->slots);
+    free(table);
+}
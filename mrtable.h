@@ -0,0 +1,128 @@
+// Key-value tables: open-addressing hash tables of strings whose values
+// are folded together when a key is added again, used to aggregate
+// records without sorting them.
+#ifndef MRTABLE_H
+#define MRTABLE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct KVTable KVTable;
+
+// Most keys worth sizing a table for from an estimate; past it a table
+// grows as it fills, so a wrong estimate costs speed rather than memory
+#define TABLE_MAX_PRESIZE ((size_t)1 << 20)
+
+/**
+* Combine two values of a key
+* Parameters:
+*     key - Key of the values
+*     a   - Value held so far
+*     b   - Value being added
+* Return:
+*     char * - Combined value, allocated with malloc, or NULL if out of memory
+*/
+typedef char *(*TableCombine)(const char *key, const char *a, const char *b);
+
+/**
+* Receive an entry of a table
+*/
+typedef void (*TableVisit)(const char *key, const char *value, void *ctx);
+
+/**
+* Hash a key (FNV-1a), as every hash table of the library does. It is
+* unrelated to MR_Partitioner's hash, so the keys of one partition still
+* spread over all the buckets of a table.
+*/
+uint64_t Table_hash(const char *key);
+
+/**
+* Create an empty table
+* Parameters:
+*     expected - Number of keys to size the table for (it grows past it)
+* Return:
+*     KVTable* - Table, or NULL if out of memory
+*/
+KVTable *Table_create(size_t expected);
+
+/**
+* Make room for a number of keys at once, so that adding up to that many
+* does not grow the table step by step
+* Parameters:
+*     table    - Table to size
+*     expected - Number of keys it will hold
+* Return:
+*     true  - On success (or if it already had room)
+*     false - If out of memory (the table is unchanged)
+*/
+bool Table_reserve(KVTable *table, size_t expected);
+
+/**
+* Add a value to a key: a new key takes a copy of the value, and the value
+* of a key already present becomes combine(key, held, value)
+* Parameters:
+*     table   - Table to add to
+*     key     - Key (copied)
+*     value   - Value (copied or combined)
+*     combine - Combine function
+* Return:
+*     true  - On success
+*     false - If out of memory (the table is unchanged)
+*/
+bool Table_add(KVTable *table, const char *key, const char *value, TableCombine combine);
+
+/**
+* Look a key up
+* Return:
+*     const char * - Value of the key, valid until the table changes
+*     NULL         - If the table has no such key
+*/
+const char *Table_get(const KVTable *table, const char *key);
+
+/**
+* Get the number of keys in a table
+*/
+size_t Table_count(const KVTable *table);
+
+/**
+* Move the entries of one table into another, combining the values of
+* keys both hold, and free the emptied table
+* Parameters:
+*     into    - Table receiving the entries
+*     from    - Table to empty and free
+*     combine - Combine function
+* Return:
+*     true  - On success
+*     false - If out of memory (the entries not yet moved are dropped)
+*/
+bool Table_merge(KVTable *into, KVTable *from, TableCombine combine);
+
+/**
+* Visit every entry of a table, in no set order
+* Parameters:
+*     table - Table to visit
+*     visit - Called once per entry
+*     ctx   - Passed through to visit
+*/
+void Table_foreach(const KVTable *table, TableVisit visit, void *ctx);
+
+/**
+* Receive an entry of a table being drained, owning its key and value
+*/
+typedef void (*TableTake)(char *key, char *value, void *ctx);
+
+/**
+* Hand every entry of a table over, in no set order, and free the table
+* Parameters:
+*     table - Table to drain and free
+*     take  - Called once per entry; frees the key and value when done
+*     ctx   - Passed through to take
+*/
+void Table_drain(KVTable *table, TableTake take, void *ctx);
+
+/**
+* Free a table and its entries
+*/
+void Table_free(KVTable *table);
+
+#endif
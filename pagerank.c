@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mriterate.h"
+
+#define DAMPING 0.85
+
+// Load the links: one "source target" pair per line
+void Load(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *dummy = line;
+        char *source = strsep(&dummy, " \t\n\r");
+        char *target = strsep(&dummy, " \t\n\r");
+        if (source && target && *source && *target) MR_Emit(source, target);
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Share a page's rank among the pages it links to
+void Rank(const char* page, char* const* links, size_t count, const char* state) {
+    double rank = state ? atof(state) : 1.0;
+    char share[32];
+    snprintf(share, sizeof(share), "%.10f", count ? rank / count : 0.0);
+    for (size_t i = 0; i < count; i++) {
+        MR_Emit(links[i], share);
+    }
+    // every page gets a new rank, linked to or not
+    MR_Emit((char*)page, "0");
+}
+
+void Sum(char* page, unsigned int partition_idx) {
+    double sum = 0;
+    char *value, rank[32];
+    while ((value = MR_GetNext(page, partition_idx)) != NULL) {
+        sum += atof(value);
+        free(value);
+    }
+    snprintf(rank, sizeof(rank), "%.6f", (1 - DAMPING) + DAMPING * sum);
+    MR_Output(page, rank);
+}
+
+// Usage: pagerank [-w workers] [-p partitions] [-i iterations] file...
+// Ranks the pages of a link graph, iterating until no rank changes in its
+// sixth decimal; results are "page: rank" lines in result-*.txt
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    IterConfig config = { Rank, Sum, 50, NULL, NULL };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:i:")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'i': config.max_iterations = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-i iterations] file...\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    MR_RunIterative(argc - optind, &argv[optind], Load, &config, workers, parts);
+    return MR_Cancelled() ? 1 : 0;
+}
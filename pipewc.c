@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrpipeline.h"
+
+// Stage 1: count the occurrences of every word
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void Count(char* key, unsigned int partition_idx) {
+    int count = 0;
+    char *value, result[16];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count++;
+        free(value);
+    }
+    sprintf(result, "%d", count);
+    MR_Output(key, result);
+}
+
+// Stage 2: count the words that occur each number of times
+void Invert(char* word, char* count) {
+    MR_Emit(count, "1");
+}
+
+// Usage: pipewc [-w workers] [-p partitions] [-m prefix] file...
+// Writes "n: words occurring n times" lines to result-*.txt, handing the
+// word counts from the first stage to the second in memory (-m also writes
+// them to <prefix>-*.txt)
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    const char *materialize = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:m:")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'm': materialize = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-m prefix] file...\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    PipelineStage stages[] = {
+        { NULL, Count, parts, materialize },
+        { Invert, Count, parts, NULL },
+    };
+    MR_RunPipeline(argc - optind, &argv[optind], Map, stages, 2, workers);
+    return MR_Cancelled() ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include "runfile.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File layout: magic, u32 header length, header (with NUL), then records of
+// u32 key length, u32 value length, key, NUL, value, NUL
+#define RUN_MAGIC "MRRUN01\n"
+#define RUN_MAGIC_LEN 8
+#define RUN_BUF_BYTES (1u << 20)
+
+struct RunWriter {
+    FILE *fp;
+    char *path;      // final path (NULL for a run written to a caller's file)
+    char *tmp_path;  // where records are written until commit
+    bool failed;
+};
+
+// Distinguishes the temporary files of concurrent writers
+static atomic_uint tmp_counter = 0;
+
+// Write the magic and header of a new run
+static RunWriter *write_header(RunWriter *w, const char *header) {
+    setvbuf(w->fp, NULL, _IOFBF, RUN_BUF_BYTES);
+
+    uint32_t hlen = (uint32_t)strlen(header) + 1;
+    if (fwrite(RUN_MAGIC, 1, RUN_MAGIC_LEN, w->fp) != RUN_MAGIC_LEN ||
+        fwrite(&hlen, sizeof(hlen), 1, w->fp) != 1 ||
+        fwrite(header, 1, hlen, w->fp) != hlen) {
+        Run_abort(w);
+        return NULL;
+    }
+    return w;
+}
+
+// Start writing a run
+RunWriter *Run_create(const char *path, const char *header) {
+    RunWriter *w = calloc(1, sizeof(RunWriter));
+    if (!w) return NULL;
+
+    size_t len = strlen(path) + 48;
+    w->path = strdup(path);
+    w->tmp_path = malloc(len);
+    if (!w->path || !w->tmp_path) goto fail;
+    snprintf(w->tmp_path, len, "%s.tmp.%d.%u", path, (int)getpid(),
+             atomic_fetch_add(&tmp_counter, 1));
+
+    w->fp = fopen(w->tmp_path, "w");
+    if (!w->fp) goto fail;
+    return write_header(w, header);
+
+fail:
+    free(w->path);
+    free(w->tmp_path);
+    free(w);
+    return NULL;
+}
+
+// Start writing a run into a caller's file
+RunWriter *Run_create_fd(int fd, const char *header) {
+    RunWriter *w = calloc(1, sizeof(RunWriter));
+    if (!w) return NULL;
+
+    // the stream gets its own descriptor, so closing it leaves fd open
+    int dup_fd = dup(fd);
+    w->fp = dup_fd >= 0 ? fdopen(dup_fd, "w") : NULL;
+    if (!w->fp) {
+        if (dup_fd >= 0) close(dup_fd);
+        free(w);
+        return NULL;
+    }
+    return write_header(w, header);
+}
+
+// Append a record
+bool Run_append(RunWriter *w, const char *key, const char *value) {
+    uint32_t lens[2] = { (uint32_t)strlen(key), (uint32_t)strlen(value) };
+    if (fwrite(lens, sizeof(lens), 1, w->fp) != 1 ||
+        fwrite(key, 1, lens[0] + 1, w->fp) != lens[0] + 1 ||
+        fwrite(value, 1, lens[1] + 1, w->fp) != lens[1] + 1) {
+        w->failed = true;
+    }
+    return !w->failed;
+}
+
+static void writer_free(RunWriter *w) {
+    free(w->path);
+    free(w->tmp_path);
+    free(w);
+}
+
+// Move a finished run into place
+bool Run_commit(RunWriter *w) {
+    if (!w->path) {
+        bool ok = !w->failed && fflush(w->fp) == 0;
+        if (fclose(w->fp) != 0) ok = false;
+        writer_free(w);
+        return ok;
+    }
+
+    // make the records durable before the run becomes visible
+    bool ok = !w->failed && fflush(w->fp) == 0 && fsync(fileno(w->fp)) == 0;
+    if (fclose(w->fp) != 0) ok = false;
+    if (ok && rename(w->tmp_path, w->path) != 0) ok = false;
+    if (!ok) unlink(w->tmp_path);
+    writer_free(w);
+    return ok;
+}
+
+// Throw away a run being written
+void Run_abort(RunWriter *w) {
+    fclose(w->fp);
+    if (w->tmp_path) unlink(w->tmp_path);
+    writer_free(w);
+}
+
+// Map a run file and check its header
+bool Run_open(RunReader *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = Run_open_fd(r, fd);
+    close(fd);
+    return ok;
+}
+
+// Map a run held in an open file and check its header
+bool Run_open_fd(RunReader *r, int fd) {
+    memset(r, 0, sizeof(*r));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < RUN_MAGIC_LEN + sizeof(uint32_t)) {
+        return false;
+    }
+    r->len = (size_t)st.st_size;
+    r->map = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return false;
+    }
+    madvise(r->map, r->len, MADV_SEQUENTIAL);
+
+    uint32_t hlen;
+    memcpy(&hlen, r->map + RUN_MAGIC_LEN, sizeof(hlen));
+    r->pos = RUN_MAGIC_LEN + sizeof(hlen) + hlen;
+    if (memcmp(r->map, RUN_MAGIC, RUN_MAGIC_LEN) != 0 || hlen == 0 || r->pos > r->len ||
+        r->map[r->pos - 1] != '\0') {
+        Run_close(r);
+        return false;
+    }
+    r->header = (const char *)r->map + RUN_MAGIC_LEN + sizeof(hlen);
+    return true;
+}
+
+// Read the next record
+bool Run_next(RunReader *r, char **key, char **value) {
+    uint32_t lens[2];
+    if (r->len - r->pos < sizeof(lens)) return false;
+    memcpy(lens, r->map + r->pos, sizeof(lens));
+
+    size_t need = sizeof(lens) + (size_t)lens[0] + 1 + (size_t)lens[1] + 1;
+    if (r->len - r->pos < need) return false;
+
+    *key = (char *)r->map + r->pos + sizeof(lens);
+    *value = *key + lens[0] + 1;
+    r->pos += need;
+    return true;
+}
+
+// Unmap a run file
+void Run_close(RunReader *r) {
+    if (r->map) munmap(r->map, r->len);
+    memset(r, 0, sizeof(*r));
+}
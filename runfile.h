@@ -0,0 +1,113 @@
+// Run files: sequences of <key, value> records written by one task and
+// read back later, used to persist map output.
+#ifndef RUNFILE_H
+#define RUNFILE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct RunWriter RunWriter;
+
+typedef struct {
+    unsigned char *map;  // mapping of the whole file
+    size_t len;          // length of the mapping
+    size_t pos;          // offset of the next record
+    const char *header;  // NUL-terminated header given to Run_create
+} RunReader;
+
+/**
+* Start writing a run file. Records go to a temporary file that only
+* replaces path once Run_commit succeeds, so a reader never sees a
+* partially written run.
+* Parameters:
+*     path   - Final path of the run file
+*     header - NUL-terminated string stored ahead of the records
+* Return:
+*     RunWriter* - Writer, or NULL if the temporary file cannot be created
+*/
+RunWriter *Run_create(const char *path, const char *header);
+
+/**
+* Start writing a run into an open file, such as a memfd shared with other
+* processes, instead of at a path
+* Parameters:
+*     fd     - Empty file to write to; stays owned by
+*              the caller and open after Run_commit or Run_abort
+*     header - NUL-terminated string stored ahead of the records
+* Return:
+*     RunWriter* - Writer, or NULL on failure
+*/
+RunWriter *Run_create_fd(int fd, const char *header);
+
+/**
+* Append a record to a run
+* Parameters:
+*     w     - Writer returned by Run_create
+*     key   - Key of the record
+*     value - Value of the record
+* Return:
+*     true  - On success
+*     false - Otherwise (the run will fail to commit)
+*/
+bool Run_append(RunWriter *w, const char *key, const char *value);
+
+/**
+* Flush a run to stable storage, move it into place and free the writer
+* (a run written with Run_create_fd is only flushed)
+* Parameters:
+*     w - Writer returned by Run_create
+* Return:
+*     true  - If the run is now stored at its path
+*     false - Otherwise (nothing is left behind)
+*/
+bool Run_commit(RunWriter *w);
+
+/**
+* Discard a run that is being written and free the writer
+* Parameters:
+*     w - Writer returned by Run_create
+*/
+void Run_abort(RunWriter *w);
+
+/**
+* Open a run file for reading
+* Parameters:
+*     r    - Reader to initialize
+*     path - Path of the run file
+* Return:
+*     true  - If the file is a run file; r->header holds its header
+*     false - Otherwise
+*/
+bool Run_open(RunReader *r, const char *path);
+
+/**
+* Open a run held in an open file for reading
+* Parameters:
+*     r  - Reader to initialize
+*     fd - File holding the run; can be closed once this returns
+* Return:
+*     true  - If the file is a run file; r->header holds its header
+*     false - Otherwise
+*/
+bool Run_open_fd(RunReader *r, int fd);
+
+/**
+* Read the next record of a run. The strings point into the mapped file
+* and stay valid until Run_close.
+* Parameters:
+*     r     - Reader opened with Run_open
+*     key   - Set to the key of the record
+*     value - Set to the value of the record
+* Return:
+*     true  - If a record was read
+*     false - At the end of the run (or on a truncated record)
+*/
+bool Run_next(RunReader *r, char **key, char **value);
+
+/**
+* Close a run file opened with Run_open
+* Parameters:
+*     r - Reader to close
+*/
+void Run_close(RunReader *r);
+
+#endif
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrsketch.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token) MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Usage: sketchwc [-w workers] [-e epsilon] [-q word]... file...
+// Estimates word counts without a shuffle: prints the number of words, an
+// estimate of the distinct ones and the estimated count of each -q word,
+// with their error bounds
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5;
+    SketchConfig config = { 0.0001, 0.01, 14 };
+    char **queries = calloc(argc, sizeof(char *));
+    int query_count = 0;
+    if (queries == NULL) return 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:e:q:")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'e': config.epsilon = atof(optarg); break;
+        case 'q': queries[query_count++] = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-e epsilon] [-q word]... file...\n", argv[0]);
+            free(queries);
+            return 1;
+        }
+    }
+
+    Sketch *sketch = MR_RunSketch(argc - optind, &argv[optind], Map, &config, workers);
+    if (sketch == NULL) {
+        free(queries);
+        return 1;
+    }
+    double error;
+    double distinct = Sketch_distinct(sketch, &error);
+    printf("words: %llu\n", (unsigned long long)Sketch_total(sketch));
+    printf("distinct: %.0f (+/- %.1f%%)\n", distinct, 100 * error);
+    for (int i = 0; i < query_count; i++) {
+        printf("%s: %llu (at most %llu over, %.0f%% of the time)\n", queries[i],
+               (unsigned long long)Sketch_count(sketch, queries[i]),
+               (unsigned long long)Sketch_error(sketch), 100 * (1 - config.delta));
+    }
+    Sketch_free(sketch);
+    free(queries);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrstream.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token) MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void Reduce(char* key, unsigned int partition_idx) {
+    int count = 0;
+    char *value, result[16];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count++;
+        free(value);
+    }
+    sprintf(result, "%d", count);
+    MR_Output(key, result);
+}
+
+static void stop(int sig) {
+    MR_StreamStop();
+}
+
+// Usage: streamwc [-b batch_ms] [-w window_ms] [-s slide_ms] [-d duration_ms] [-a] file...
+// Tails the files ("-" for stdin) and prints word counts per window
+int main(int argc, char *argv[]) {
+    StreamConfig config;
+    Stream_default_config(&config);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:s:d:a")) != -1) {
+        switch (opt) {
+        case 'b': config.batch_ms = atoi(optarg); break;
+        case 'w': config.window_ms = atoi(optarg); break;
+        case 's': config.slide_ms = atoi(optarg); break;
+        case 'd': config.duration_ms = strtoull(optarg, NULL, 10); break;
+        case 'a': config.from_start = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-b batch_ms] [-w window_ms] [-s slide_ms] [-d duration_ms] [-a] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.slide_ms > config.window_ms) config.slide_ms = config.window_ms;
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    MR_Stream(argc - optind, &argv[optind], Map, Reduce, 5, 10, &config);
+    return 0;
+}
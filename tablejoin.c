@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mrbroadcast.h"
+#include "mrjoin.h"
+
+// Left table, when it is broadcast
+static Broadcast *left_table = NULL;
+
+// Emit every "key rest-of-line" line of a table
+void Rows(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *rest = line;
+        char *key = strsep(&rest, " \t");
+        if (*key) MR_Emit(key, rest ? rest : "");
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Pair every row of the left table with every row of the right one,
+// holding only the left rows of the key
+void Join(char* key, unsigned int partition_idx) {
+    char **left = NULL, *value;
+    size_t count = 0;
+    while ((value = MR_GetNextFrom(key, partition_idx, 0)) != NULL) {
+        char **grown = realloc(left, (count + 1) * sizeof(char*));
+        if (grown == NULL) {
+            free(value);
+            break;
+        }
+        left = grown;
+        left[count++] = value;
+    }
+
+    while (count > 0 && (value = MR_GetNextFrom(key, partition_idx, 1)) != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            char *row = malloc(strlen(left[i]) + strlen(value) + 2);
+            if (row == NULL) continue;
+            sprintf(row, "%s\t%s", left[i], value);
+            MR_Output(key, row);
+            free(row);
+        }
+        free(value);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(left[i]);
+    }
+    free(left);
+}
+
+// Join the rows of the right table with the broadcast left one in place
+void Enrich(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *rest = line;
+        char *key = strsep(&rest, " \t");
+        const char *left = Broadcast_get(left_table, key);
+        if (left == NULL) continue;
+        if (rest == NULL) rest = "";
+        char *row = malloc(strlen(left) + strlen(rest) + 2);
+        if (row == NULL) continue;
+        sprintf(row, "%s\t%s", left, rest);
+        MR_Emit(key, row);
+        free(row);
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Usage: tablejoin [-w workers] [-p partitions] [-b] left.txt right.txt
+// Inner join of two tables on their first column; results are
+// "key: left-row<TAB>right-row" lines in result-*.txt (put the smaller
+// table on the left, as only its rows are held per key). With -b the left
+// table, whose keys must then be unique, is broadcast to the map tasks,
+// which write the joined rows themselves with no shuffle.
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10;
+    bool broadcast = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:b")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'b': broadcast = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-b] left.txt right.txt\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-b] left.txt right.txt\n", argv[0]);
+        return 1;
+    }
+
+    if (broadcast) {
+        left_table = Broadcast_load(1, &argv[optind]);
+        if (left_table == NULL) {
+            fprintf(stderr, "%s: cannot load %s\n", argv[0], argv[optind]);
+            return 1;
+        }
+        MR_RunMapOnly(1, &argv[optind + 1], Enrich, NULL, NULL, workers);
+        Broadcast_free(left_table);
+        return MR_Cancelled() ? 1 : 0;
+    }
+
+    JoinInput inputs[2] = {
+        { 1, &argv[optind], Rows },
+        { 1, &argv[optind + 1], Rows },
+    };
+    MR_RunJoin(inputs, 2, Join, workers, parts);
+    return MR_Cancelled() ? 1 : 0;
+}
@@ -1,6 +1,16 @@
 #include "threadpool.h"
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
+
+// Job run by the current thread, for ThreadPool_job_cancelled
+static __thread ThreadPool_job_t *current_job = NULL;
+
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 // Add job into queue sorted by job_size (SJF)
 static void add_job_to_queue(ThreadPool_job_queue_t *q, ThreadPool_job_t *job) {
@@ -26,6 +36,7 @@ ThreadPool_t *ThreadPool_create(unsigned int num) {
     if (num == 0) return NULL;
     ThreadPool_t *tp = (ThreadPool_t*) malloc(sizeof(ThreadPool_t));
     tp->threads = (pthread_t*) malloc(sizeof(pthread_t) * num);
+    tp->running = (ThreadPool_job_t**) calloc(num, sizeof(ThreadPool_job_t*));
     tp->num_threads = num;
     tp->active_workers = 0;
     tp->jobs.head = NULL;
@@ -67,16 +78,26 @@ void ThreadPool_destroy(ThreadPool_t *tp) {
     pthread_cond_destroy(&tp->all_idle);
 
     free(tp->threads);
+    free(tp->running);
     free(tp);
 }
 
 // Add a job to the thread pool
 bool ThreadPool_add_job(ThreadPool_t *tp, thread_func_t func, void *arg, size_t job_size) {
+    return ThreadPool_add_cancellable_job(tp, func, arg, job_size, NULL, 0);
+}
+
+// Add a job with a cancellation token and a timeout
+bool ThreadPool_add_cancellable_job(ThreadPool_t *tp, thread_func_t func, void *arg, size_t job_size,
+                                    ThreadPool_token_t *token, unsigned int timeout_ms) {
     ThreadPool_job_t *job = (ThreadPool_job_t *) malloc(sizeof(ThreadPool_job_t));
     job->func = func;
     job->arg = arg;
     job->job_size = job_size;
     job->next = NULL;
+    job->token = token;
+    job->timeout_ms = timeout_ms;
+    job->deadline_ns = 0;
 
     pthread_mutex_lock(&tp->lock);
     if (tp->stop){ // don't add new jobs if the thread pool is stopped
@@ -126,14 +147,24 @@ void *Thread_run(void *arg) {
         }
 
         tp->active_workers++;
+        // the deadline counts from when the job starts running
+        if (job->timeout_ms) {
+            job->deadline_ns = monotonic_ns() + (long long)job->timeout_ms * 1000000LL;
+        }
+        unsigned int slot = 0;
+        while (tp->running[slot]) slot++;
+        tp->running[slot] = job;
         pthread_mutex_unlock(&tp->lock);
 
         // run job outside the lock
+        current_job = job;
         job->func(job->arg);
+        current_job = NULL;
 
         pthread_mutex_lock(&tp->lock);
 
         tp->active_workers--;
+        tp->running[slot] = NULL;
 
         // signal all_idle if no jobs and no active workers
         if (tp->jobs.size == 0 && tp->active_workers == 0) {
@@ -153,4 +184,60 @@ void ThreadPool_check(ThreadPool_t *tp) {
         pthread_cond_wait(&tp->all_idle, &tp->lock);
     }
     pthread_mutex_unlock(&tp->lock);
-}
\ No newline at end of file
+}
+// Wait until all jobs are completed and all workers are idle, or the timeout passes
+bool ThreadPool_check_timed(ThreadPool_t *tp, unsigned int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&tp->lock);
+    while (tp->jobs.size > 0 || tp->active_workers > 0) {
+        if (pthread_cond_timedwait(&tp->all_idle, &tp->lock, &deadline) != 0) break;
+    }
+    bool idle = tp->jobs.size == 0 && tp->active_workers == 0;
+    pthread_mutex_unlock(&tp->lock);
+    return idle;
+}
+
+// Number of workers with nothing to run
+unsigned int ThreadPool_idle_workers(ThreadPool_t *tp) {
+    pthread_mutex_lock(&tp->lock);
+    unsigned int idle = tp->jobs.size > 0 ? 0 : tp->num_threads - tp->active_workers;
+    pthread_mutex_unlock(&tp->lock);
+    return idle;
+}
+
+// Whether the job run by this thread should stop
+bool ThreadPool_job_cancelled(void) {
+    ThreadPool_job_t *job = current_job;
+    if (!job || !job->token) return false;
+    if (atomic_load_explicit(&job->token->cancelled, memory_order_relaxed)) return true;
+    return job->deadline_ns && monotonic_ns() >= job->deadline_ns;
+}
+
+// Cancel the jobs of a token
+void ThreadPool_cancel(ThreadPool_token_t *token) {
+    atomic_store(&token->cancelled, true);
+}
+
+// Cancel the tokens of running jobs past their deadline
+unsigned int ThreadPool_expire(ThreadPool_t *tp) {
+    unsigned int expired = 0;
+    long long now = monotonic_ns();
+
+    pthread_mutex_lock(&tp->lock);
+    for (unsigned int i = 0; i < tp->num_threads; i++) {
+        ThreadPool_job_t *job = tp->running[i];
+        if (!job || !job->token || !job->deadline_ns || now < job->deadline_ns) continue;
+        ThreadPool_cancel(job->token);
+        expired++;
+    }
+    pthread_mutex_unlock(&tp->lock);
+    return expired;
+}
@@ -2,16 +2,26 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 
 typedef void (*thread_func_t)(void* arg);
 
+// Cancellation token shared by the jobs of one piece of work. Jobs check it
+// with ThreadPool_job_cancelled and return early once it is set.
+typedef struct {
+    atomic_bool cancelled;
+} ThreadPool_token_t;
+
 typedef struct ThreadPool_job_t {
     thread_func_t func;             // function pointer
     void* arg;                      // arguments for that function
     struct ThreadPool_job_t* next;  // pointer to the next job in the queue
     size_t job_size;                // size of the job
+    ThreadPool_token_t* token;      // cancellation token (NULL if none)
+    unsigned int timeout_ms;        // time the job may run (0 = no limit)
+    long long deadline_ns;          // when a running job times out (0 = never)
 } ThreadPool_job_t;
 
 typedef struct {
@@ -24,6 +34,7 @@ typedef struct {
     ThreadPool_job_queue_t jobs;  // queue of jobs waiting for a thread to run
     unsigned int num_threads;     // number of threads in the pool
     unsigned int active_workers;  // number of threads currently running
+    ThreadPool_job_t** running;   // job run by each thread (NULL when idle)
     bool stop;  // shutdown flag
     pthread_mutex_t lock; // mutex for the thread pool
     pthread_cond_t has_job; // condition variable for new jobs
@@ -59,6 +70,50 @@ void ThreadPool_destroy(ThreadPool_t* tp);
 */
 bool ThreadPool_add_job(ThreadPool_t* tp, thread_func_t func, void* arg, size_t job_size);
 
+/**
+* Add a job that can be cancelled through a token and that times out
+* Parameters:
+*     tp         - Pointer to the ThreadPool object
+*     func       - Pointer to the function that will be called by the serving thread
+*     arg        - Arguments for that function
+*     job_size   - Size of the job (shorter jobs run first)
+*     token      - Cancellation token of the job, or NULL
+*     timeout_ms - Time the job may run once started before ThreadPool_expire
+*                  cancels its token (0 = no limit)
+* Return:
+*     true  - On success
+*     false - Otherwise
+* Note: jobs whose token is cancelled while they are queued still run, so
+*       that they can release their arguments; they should return at once
+*/
+bool ThreadPool_add_cancellable_job(ThreadPool_t* tp, thread_func_t func, void* arg, size_t job_size,
+                                    ThreadPool_token_t* token, unsigned int timeout_ms);
+
+/**
+* Check from inside a job whether it should stop
+* Return:
+*     true  - If the job's token is cancelled or its deadline has passed
+*     false - Otherwise (always for jobs without a token)
+*/
+bool ThreadPool_job_cancelled(void);
+
+/**
+* Cancel a token, so that its jobs see ThreadPool_job_cancelled
+* Parameters:
+*     token - Token to cancel
+* Note: safe to call from a signal handler
+*/
+void ThreadPool_cancel(ThreadPool_token_t* token);
+
+/**
+* Cancel the tokens of running jobs that are past their deadline
+* Parameters:
+*     tp - Pointer to the ThreadPool object
+* Return:
+*     unsigned int - Number of jobs found past their deadline
+*/
+unsigned int ThreadPool_expire(ThreadPool_t* tp);
+
 /**
 * Get a job from the job queue of the ThreadPool object
 * Parameters:
@@ -84,4 +139,24 @@ void* Thread_run(void* arg);
 */
 void ThreadPool_check(ThreadPool_t *tp);
 
+/**
+* Like ThreadPool_check, but give up after a timeout
+* Parameters:
+*     tp         - Pointer to the ThreadPool object
+*     timeout_ms - Longest time to wait in milliseconds
+* Return:
+*     true  - If all threads are idle and the job queue is empty
+*     false - If the timeout passed first
+*/
+bool ThreadPool_check_timed(ThreadPool_t *tp, unsigned int timeout_ms);
+
+/**
+* Count the threads that have nothing to do
+* Parameters:
+*     tp - Pointer to the ThreadPool object
+* Return:
+*     unsigned int - Number of idle threads, or 0 while jobs are queued
+*/
+unsigned int ThreadPool_idle_workers(ThreadPool_t *tp);
+
 #endif
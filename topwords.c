@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mraggregate.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token) MR_Emit(token, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Values are counts: 1 per occurrence, or more once combined
+void Reduce(char* key, unsigned int partition_idx) {
+    long long count = 0;
+    char *value, result[32];
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        count += strtoll(value, NULL, 10);
+        free(value);
+    }
+    snprintf(result, sizeof(result), "%lld", count);
+    MR_Output(key, result);
+}
+
+// Usage: topwords [-w workers] [-p partitions] [-k count] [-c] file...
+// Counts words and keeps only the most frequent ones (100 by default):
+// each partition holds its best k counts in a heap, and the heaps are
+// merged into result-top.txt, most frequent first; with -c, partitions
+// add up the counts of a word as they arrive and hold one record per word
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5, parts = 10, k = 100;
+    bool combine = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:p:k:c")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 'p': parts = atoi(optarg); break;
+        case 'k': k = atoi(optarg); break;
+        case 'c': combine = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p partitions] [-k count] [-c] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    MR_SetTopK(k, NULL);
+    if (combine) MR_SetPartitionCombine(Aggregate_sum);
+    MR_Run(argc - optind, &argv[optind], Map, Reduce, workers, parts);
+    return MR_Cancelled() ? 1 : 0;
+}
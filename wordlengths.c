@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mraggregate.h"
+
+void Map(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    char* line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, fp) != -1) {
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            if (*token == '\0') continue;
+            char length[24];
+            snprintf(length, sizeof(length), "%zu", strlen(token));
+            MR_Emit(length, "1");
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+// Usage: wordlengths [-w workers] [-t] file...
+// Counts the words of each length into one map that every map task updates
+// with atomic adds; with -t, each map task counts into a table of its own
+// and the tables are merged in a tree instead. Results are "length: words"
+// lines in result-0.txt
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5;
+    bool tables = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:t")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        case 't': tables = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-t] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    MR_SetKeyOrder(MR_CompareNumeric, NULL);
+    if (tables) {
+        MR_RunAggregate(argc - optind, &argv[optind], Map, Aggregate_sum, workers, 1);
+    } else {
+        MR_RunCounters(argc - optind, &argv[optind], Map, COUNTER_SUM, 4096, workers, 1);
+    }
+    return MR_Cancelled() ? 1 : 0;
+}
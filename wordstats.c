@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mapreduce.h"
+#include "mapreduce_ext.h"
+#include "mraggregate.h"
+
+// Count the lines, words and characters of an input and find its longest
+// word, emitting each statistic once per input
+void Stats(char* file_name) {
+    FILE* fp = fopen(file_name, "r");
+    if (fp == NULL) return;
+
+    long long lines = 0, words = 0, chars = 0, longest = 0;
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &size, fp)) != -1) {
+        lines++;
+        chars += len;
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            long long n = strlen(token);
+            if (n == 0) continue;
+            words++;
+            if (n > longest) longest = n;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    char value[32];
+    snprintf(value, sizeof(value), "%lld", lines);
+    MR_Emit("lines", value);
+    snprintf(value, sizeof(value), "%lld", words);
+    MR_Emit("words", value);
+    snprintf(value, sizeof(value), "%lld", chars);
+    MR_Emit("chars", value);
+    snprintf(value, sizeof(value), "%lld", longest);
+    MR_Emit("longest", value);
+}
+
+// The longest word is the greatest of the inputs', the rest add up
+char* Combine(const char* key, const char* a, const char* b) {
+    if (strcmp(key, "longest") == 0) return Aggregate_max(key, a, b);
+    return Aggregate_sum(key, a, b);
+}
+
+// Usage: wordstats [-w workers] file...
+// Totals the lines, words and characters of the inputs and finds the
+// length of their longest word, merging the statistics of the inputs in a
+// tree; results are "statistic: value" lines in result-0.txt
+int main(int argc, char *argv[]) {
+    unsigned int workers = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:")) != -1) {
+        switch (opt) {
+        case 'w': workers = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    MR_RunAggregate(argc - optind, &argv[optind], Stats, Combine, workers, 1);
+    return MR_Cancelled() ? 1 : 0;
+}